@@ -16,7 +16,10 @@ static atem::Atem* _atem = nullptr;
 
 static void atem_handler(void* arg, esp_event_base_t event_base,
                          int32_t event_id, void* event_data) {
-  ESP_LOGI(TAG, "Got ATEM event with id: %lu", event_id);
+  // The dirty mask tells which ME, keyer, DSK, aux... has changed
+  const atem::AtemEventData* data = (const atem::AtemEventData*)event_data;
+  ESP_LOGI(TAG, "Got ATEM event with id: %lu (dirty: %llx)", event_id,
+           (unsigned long long)data->dirty);
 
   // Example usage
   // it's important to take the semaphore (e.g. lock the state)
@@ -76,13 +76,13 @@ extern "C" void app_main(void) {
 
     // Check if the next source is valid for this ATEM
     preview_source = atem::Source(int(preview_source) + 1);
-    if (!_atem->GetInputProperties().contains(preview_source)) {
+    if (!_atem->GetInputProperties().Contains(preview_source)) {
       preview_source = atem::Source::BLACK;
     }
 
     // Change the preview input
     ESP_ERROR_CHECK_WITHOUT_ABORT(
-        _atem->SendCommands({new atem::cmd::PreviewInput(preview_source, 0)}));
+        _atem->SendCommands(atem::cmd::PreviewInput(preview_source, 0)));
 
   next:
     xSemaphoreGive(_atem->GetStateMutex());
@@ -0,0 +1,376 @@
+#include <atem_packet.h>
+#include <atem_parser.h>
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <map>
+#include <new>
+#include <vector>
+
+using namespace atem;
+typedef std::chrono::steady_clock Clock;
+
+// MARK: Allocation counter
+
+// Counts all C++ allocations (e.g. the nodes of the maps in the state), the
+// buffers that are allocated with malloc (e.g. the file names) aren't counted.
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size);
+  if (p == nullptr) abort();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t size) noexcept { free(p); }
+
+// MARK: Dumps
+
+/**
+ * @brief The properties of a model that determine the size of its initial
+ * state.
+ */
+struct Model {
+  const char* name;
+  uint8_t me;
+  uint8_t inputs;
+  uint8_t dsk;
+  uint8_t aux;
+  uint8_t mediaplayers;
+  uint8_t usk;
+  uint8_t multiviewers;
+  uint8_t stills;
+};
+
+static const Model kModels[] = {
+    {"ATEM Mini", 1, 4, 1, 1, 1, 1, 1, 20},
+    {"ATEM Mini Extreme", 1, 8, 2, 3, 2, 4, 1, 20},
+    {"ATEM 1 M/E Production Studio 4K", 1, 10, 2, 3, 2, 4, 1, 20},
+    {"ATEM 2 M/E Production Studio 4K", 2, 20, 2, 6, 2, 4, 2, 32},
+    {"ATEM Constellation 8K", 4, 40, 4, 24, 4, 4, 4, 64},
+};
+
+/**
+ * @brief A list of packets as they are send by an ATEM after the INIT.
+ */
+class Dump {
+ public:
+  /**
+   * @brief Add a command without any data, used for commands that aren't
+   * parsed by the library.
+   *
+   * @param cmd[in] The 4 characters of the command
+   * @param length[in] The length of the command including the header
+   * @return AtemCommand A command that points into the packet
+   */
+  AtemCommand Raw(const char* cmd, uint16_t length) {
+    length = (length + 3) & ~3;
+
+    if (this->packets_.empty() || this->packets_.back().size() + length > 1400)
+      this->packets_.emplace_back(12, 0);
+
+    std::vector<uint8_t>& packet = this->packets_.back();
+    packet.resize(packet.size() + length, 0);
+    uint8_t* data = packet.data() + packet.size() - length;
+    data[0] = length >> 8;
+    data[1] = length & 0xFF;
+    memcpy(data + 4, cmd, 4);
+    this->commands_++;
+
+    return AtemCommand(data);
+  }
+  /**
+   * @brief Add a command and encode all fields of its layout
+   */
+  template <typename L, typename... Values>
+  void Command(const char* cmd, Values... values) {
+    AtemCommand command = this->Raw(cmd, L::kLength);
+    L::Encode(command, values...);
+  }
+  /**
+   * @brief Write all packet headers, this must be called before parsing.
+   */
+  void Finish() {
+    for (uint16_t id = 1; auto& packet : this->packets_) {
+      AtemPacket p(packet.data());
+      p.SetFlags(0x1);
+      ((uint16_t*)packet.data())[0] |= htons(packet.size());
+      ((uint16_t*)packet.data())[1] = htons(0x8001);
+      p.SetId(id++);
+    }
+  }
+
+  std::vector<std::vector<uint8_t>>& GetPackets() { return this->packets_; }
+  size_t GetCommands() const { return this->commands_; }
+
+ protected:
+  std::vector<std::vector<uint8_t>> packets_;
+  size_t commands_{0};
+};
+
+static void AddInput(Dump& dump, Source source, const char* name_long,
+                     const char* name_short) {
+  // The real command also contains the port types
+  AtemCommand inpr = dump.Raw("InPr", 44);
+  layout::InputProperty::Encode(inpr, source, name_long, name_short);
+}
+
+static Dump CreateDump(const Model& m) {
+  Dump dump;
+  char name_long[21], name_short[5];
+
+  // Global state
+  dump.Command<layout::ProtocolVersion>("_ver", uint16_t(2), uint16_t(30));
+  dump.Command<layout::ProductId>("_pin", m.name);
+
+  AtemCommand top = dump.Raw("_top", layout::TopologyExtended::kLength);
+  layout::Topology::Encode(top, m.me, m.inputs, m.dsk, m.aux, 0,
+                           m.mediaplayers, m.multiviewers, 1, 4, 1, 1, 1);
+  layout::TopologyExtended::Encode(top, 0, 0);
+
+  for (uint8_t me = 0; me < m.me; me++)
+    dump.Command<layout::MixEffectConfig>("_MeC", me, m.usk);
+  dump.Command<layout::MediaPlayer>("_mpl", m.stills, uint8_t(0));
+  dump.Raw("_MvC", 12);
+  dump.Raw("_SSC", 12);
+  dump.Raw("_TlC", 12);
+  dump.Raw("_AMC", 12);
+  dump.Raw("_VMC", 28);
+  dump.Raw("Powr", 12);
+  dump.Raw("VidM", 12);
+  dump.Raw("TcLk", 12);
+
+  // Inputs
+  AddInput(dump, BLACK, "Black", "BLK");
+  for (uint8_t i = 1; i <= m.inputs; i++) {
+    snprintf(name_long, sizeof(name_long), "Camera %u", i);
+    snprintf(name_short, sizeof(name_short), "CAM%u", i);
+    AddInput(dump, (Source)i, name_long, name_short);
+  }
+  AddInput(dump, COLOR_BARS, "Color Bars", "BARS");
+  AddInput(dump, COLOR_GEN_1, "Color 1", "COL1");
+  AddInput(dump, COLOR_GEN_2, "Color 2", "COL2");
+  for (uint8_t mp = 0; mp < m.mediaplayers; mp++) {
+    snprintf(name_long, sizeof(name_long), "Media Player %u", mp + 1);
+    snprintf(name_short, sizeof(name_short), "MP%u", mp + 1);
+    AddInput(dump, Source(MEDIAPLAYER_1 + mp * 10), name_long, name_short);
+    AddInput(dump, Source(MEDIAPLAYER_1_KEY + mp * 10), name_long, name_short);
+  }
+  for (uint8_t me = 0; me < m.me; me++) {
+    AddInput(dump, Source(ME1_PROGRAM + me * 10), "Program", "PGM");
+    AddInput(dump, Source(ME1_PREVIEW + me * 10), "Preview", "PVW");
+  }
+  for (uint8_t aux = 0; aux < m.aux; aux++) {
+    snprintf(name_long, sizeof(name_long), "Output %u", aux + 1);
+    snprintf(name_short, sizeof(name_short), "OUT%u", aux + 1);
+    AddInput(dump, Source(AUX_1 + aux), name_long, name_short);
+  }
+
+  // Multiviewers
+  for (uint8_t mv = 0; mv < m.multiviewers; mv++) {
+    dump.Raw("MvPr", 12);
+    for (uint8_t window = 0; window < 10; window++) {
+      dump.Raw("MvIn", 12);
+      dump.Raw("VuMC", 12);
+      dump.Raw("SaMw", 12);
+    }
+  }
+
+  // Mix effects
+  for (uint8_t me = 0; me < m.me; me++) {
+    dump.Command<layout::MeSource>("PrgI", me, Source(me + 1));
+    dump.Command<layout::MeSource>("PrvI", me, Source(me + 2));
+    dump.Command<layout::TransitionState>("TrSS", me, uint8_t(0),
+                                          uint8_t(1));
+    dump.Raw("TrPr", 12);
+    dump.Command<layout::TransitionPosition>("TrPs", me, uint8_t(0),
+                                             uint16_t(0));
+    dump.Raw("TMxP", 12);
+    dump.Raw("TDpP", 20);
+    dump.Raw("TWpP", 28);
+    dump.Raw("TDvP", 20);
+    dump.Raw("TStP", 28);
+    dump.Command<layout::FadeToBlack>("FtbS", me, false, false);
+    dump.Raw("FtbP", 12);
+
+    for (uint8_t k = 0; k < m.usk; k++) {
+      dump.Command<layout::UskOnAir>("KeOn", me, k, false);
+      dump.Command<layout::UskProperties>("KeBP", me, k, uint8_t(0),
+                                          Source(3), Source(4), int16_t(9000),
+                                          int16_t(-9000), int16_t(-16000),
+                                          int16_t(16000));
+      dump.Raw("KeLm", 16);
+      dump.Raw("KACk", 28);
+      dump.Raw("KACC", 48);
+      dump.Raw("KePt", 24);
+      dump.Command<layout::UskDve>("KeDV", me, k, 500, 500, 0, 0, 0);
+      dump.Command<layout::UskFlyState>("KeFS", me, k, true);
+      dump.Raw("KKFP", 64);
+      dump.Raw("KKFP", 64);
+    }
+  }
+
+  // Downstream keyers
+  for (uint8_t k = 0; k < m.dsk; k++) {
+    dump.Command<layout::DskSource>("DskB", k, Source(5), Source(6));
+    dump.Command<layout::DskFlag>("DskP", k, false);
+    dump.Command<layout::DskState>("DskS", k, false, false, false);
+  }
+
+  // Aux outputs
+  for (uint8_t aux = 0; aux < m.aux; aux++)
+    dump.Command<layout::AuxSelect>("AuxS", aux, Source(aux + 1));
+
+  // Media players and pool
+  for (uint8_t mp = 0; mp < m.mediaplayers; mp++) {
+    dump.Command<layout::MediaPlayerSource>("MPCE", mp, uint8_t(1), mp,
+                                            uint8_t(0));
+    dump.Raw("RCPS", 16);
+  }
+  for (uint16_t i = 0; i < m.stills; i++) {
+    char name[32];
+    const uint8_t len = snprintf(name, sizeof(name), "Still %u.png", i + 1);
+
+    AtemCommand mpfe =
+        dump.Raw("MPfe", layout::MediaPoolFrame::kLength + len);
+    layout::MediaPoolFrame::Encode(mpfe, uint8_t(0), i, true, len);
+    memcpy(mpfe.GetData<char*>() + layout::MediaPoolFrame::kLength - 8, name,
+           len);
+  }
+
+  // Streaming
+  AtemCommand strs = dump.Raw("StRS", 12);
+  layout::StreamStatus::Encode(strs, uint16_t(StreamState::IDLE));
+  dump.Raw("SRSU", 12);
+  dump.Raw("InCm", 12);
+
+  dump.Finish();
+  return dump;
+}
+
+// MARK: Benchmark
+
+struct Stats {
+  size_t count;
+  int64_t ns;
+  size_t allocations;
+};
+
+/**
+ * @brief Parse a packet the same way Atem::ParsePacket_ does.
+ */
+static void ParsePacket(parser::Context& ctx, AtemPacket& packet) {
+  for (AtemCommand command : packet) {
+    const uint32_t cmd = ATEM_CMD(((char*)command.GetCmd()));
+    parser::Handler handler = parser::FindHandler(cmd);
+    if (handler != nullptr) handler(ctx, command);
+  }
+}
+
+/**
+ * @brief Measure the time it takes to read the clock twice, this is subtracted
+ * from the time of every command that is measured on its own.
+ */
+static double ClockOverhead() {
+  int64_t ns = 0;
+  for (int i = 0; i < 1000; i++) {
+    const Clock::time_point start = Clock::now();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                               start)
+              .count();
+  }
+  return ns / 1000.0;
+}
+
+static void Benchmark(const Model& m, double overhead) {
+  Dump dump = CreateDump(m);
+  std::vector<std::vector<uint8_t>>& packets = dump.GetPackets();
+
+  size_t bytes = 0;
+  for (auto& p : packets) bytes += p.size();
+  printf("\n%s: %u packets, %u commands, %u bytes\n", m.name,
+         (unsigned)packets.size(), (unsigned)dump.GetCommands(),
+         (unsigned)bytes);
+
+  // Parse the complete dump
+  int64_t ns = 0;
+  size_t allocs = 0;
+
+  for (int i = 0; i < CONFIG_BENCHMARK_ITERATIONS; i++) {
+    SwitcherState state;
+    const size_t start_allocs = allocations;
+    const Clock::time_point start = Clock::now();
+
+    for (auto& p : packets) {
+      AtemPacket packet(p.data());
+      parser::Context ctx{.state = state, .id = packet.GetId()};
+      ParsePacket(ctx, packet);
+    }
+
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                               start)
+              .count();
+    allocs += allocations - start_allocs;
+    state.Reset();
+  }
+
+  const double runs = CONFIG_BENCHMARK_ITERATIONS;
+  printf("  %.0f ns/packet, %.0f ns/command, %.2f allocations/packet\n",
+         ns / runs / packets.size(), ns / runs / dump.GetCommands(),
+         allocs / runs / packets.size());
+
+  // Parse every command on its own, to get the cost per command type
+  std::map<uint32_t, Stats> stats;
+  for (auto& p : packets) {
+    AtemPacket packet(p.data());
+    for (AtemCommand command : packet)
+      stats[ATEM_CMD(((char*)command.GetCmd()))] = {};
+  }
+
+  for (int i = 0; i < CONFIG_BENCHMARK_ITERATIONS; i++) {
+    SwitcherState state;
+
+    for (auto& p : packets) {
+      AtemPacket packet(p.data());
+      parser::Context ctx{.state = state, .id = packet.GetId()};
+
+      for (AtemCommand command : packet) {
+        const size_t start_allocs = allocations;
+        const Clock::time_point start = Clock::now();
+
+        const uint32_t cmd = ATEM_CMD(((char*)command.GetCmd()));
+        parser::Handler handler = parser::FindHandler(cmd);
+        if (handler != nullptr) handler(ctx, command);
+
+        const Clock::time_point end = Clock::now();
+        Stats& s = stats.find(cmd)->second;
+        s.count++;
+        s.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end -
+                                                                     start)
+                    .count();
+        s.allocations += allocations - start_allocs;
+      }
+    }
+
+    state.Reset();
+  }
+
+  printf("  cmd  handled  count/dump  ns/command  allocations/command\n");
+  for (auto& [cmd, s] : stats) {
+    printf("  %c%c%c%c %-8s %10u %11.0f %20.2f\n", char(cmd >> 24),
+           char(cmd >> 16), char(cmd >> 8), char(cmd),
+           parser::FindHandler(cmd) != nullptr ? "yes" : "no",
+           (unsigned)(s.count / CONFIG_BENCHMARK_ITERATIONS),
+           (double)s.ns / s.count - overhead,
+           (double)s.allocations / s.count);
+  }
+}
+
+extern "C" void app_main(void) {
+  printf("Parsing every dump %u times\n", CONFIG_BENCHMARK_ITERATIONS);
+  const double overhead = ClockOverhead();
+  for (const Model& m : kModels) Benchmark(m, overhead);
+}
@@ -0,0 +1,146 @@
+#include <atem_still.h>
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using namespace atem;
+typedef std::chrono::steady_clock Clock;
+
+static constexpr uint16_t kWidth = CONFIG_BENCHMARK_WIDTH & ~1;
+static constexpr uint16_t kHeight = CONFIG_BENCHMARK_HEIGHT;
+
+// MARK: Images
+
+/**
+ * @brief A synthetic image, every line is one of a few prepared lines so
+ * reading a line costs no more than a copy.
+ */
+struct Image {
+  const char* name;
+  std::vector<std::vector<uint8_t>> lines;
+  // Selects the line for every y
+  uint8_t (*select)(uint16_t y);
+};
+
+static std::vector<uint8_t> Line(uint8_t (*pixel)(uint16_t x, uint8_t c)) {
+  std::vector<uint8_t> line(kWidth * 4);
+  for (uint16_t x = 0; x < kWidth; x++)
+    for (uint8_t c = 0; c < 4; c++) line[x * 4 + c] = pixel(x, c);
+  return line;
+}
+
+static std::vector<Image> CreateImages() {
+  std::vector<Image> images;
+
+  // A lower third, mostly transparent with a bar of a single color
+  images.push_back({"Lower third", {}, [](uint16_t y) -> uint8_t {
+                      if (y < kHeight * 3 / 4 || y > kHeight * 7 / 8) return 0;
+                      return 1;
+                    }});
+  images.back().lines.push_back(Line([](uint16_t, uint8_t) -> uint8_t {
+    return 0;
+  }));
+  images.back().lines.push_back(Line([](uint16_t x, uint8_t c) -> uint8_t {
+    if (x < kWidth / 10 || x > kWidth * 6 / 10) return 0;
+    return c == 3 ? 255 : (c == 2 ? 160 : 32);
+  }));
+
+  // A logo on a flat background with a gradient
+  images.push_back({"Gradient", {}, [](uint16_t y) -> uint8_t {
+                      return y < kHeight / 3 ? 0 : (y < kHeight / 2 ? 1 : 2);
+                    }});
+  images.back().lines.push_back(Line([](uint16_t x, uint8_t c) -> uint8_t {
+    return c == 3 ? 255 : (x * 255 / kWidth) ^ (c * 85);
+  }));
+  images.back().lines.push_back(Line([](uint16_t x, uint8_t c) -> uint8_t {
+    return c == 3 ? 255 : ((x / 64) % 2 ? 240 : 16);
+  }));
+  images.back().lines.push_back(Line([](uint16_t, uint8_t c) -> uint8_t {
+    return c == 3 ? 255 : 128;
+  }));
+
+  // Noise, the worst case for the RLE
+  images.push_back({"Noise", {}, [](uint16_t y) -> uint8_t { return y % 4; }});
+  for (int i = 0; i < 4; i++) {
+    std::vector<uint8_t> line(kWidth * 4);
+    for (auto& b : line) b = rand();
+    images.back().lines.push_back(line);
+  }
+
+  return images;
+}
+
+// MARK: Benchmark
+
+static bool ReadLine(uint8_t* line, uint16_t y, void* arg) {
+  const Image* image = (const Image*)arg;
+  memcpy(line, image->lines[image->select(y)].data(), kWidth * 4);
+  return true;
+}
+
+static double MBps(size_t bytes, int64_t ns) {
+  return ns == 0 ? 0 : bytes * 1000.0 / ns;
+}
+
+static int64_t Elapsed(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+static void Benchmark(Image& image) {
+  const size_t decoded = (size_t)kWidth * kHeight * 4;
+  int64_t convert_ns = 0, compress_ns = 0, read_ns = 0;
+  size_t encoded = 0;
+
+  std::vector<uint8_t> rgba(kWidth * 4), yuva(kWidth * 4);
+  std::vector<uint8_t> chunk(1380);
+
+  for (int i = 0; i < CONFIG_BENCHMARK_ITERATIONS; i++) {
+    StillEncoder encoder(kWidth, kHeight, StillEncoder::Format::kRGBA,
+                         ReadLine, &image);
+    std::vector<uint8_t> out(encoder.GetMaxLineLength());
+
+    // Measure both steps on their own
+    for (uint16_t y = 0; y < kHeight; y++) {
+      ReadLine(rgba.data(), y, &image);
+
+      Clock::time_point start = Clock::now();
+      StillEncoder::ConvertLine(rgba.data(), yuva.data(), kWidth);
+      convert_ns += Elapsed(start);
+
+      start = Clock::now();
+      encoder.CompressLine(yuva.data(), out.data());
+      compress_ns += Elapsed(start);
+    }
+    encoder.Flush(out.data());
+
+    // Read the still in chunks, the same way MediaUpload does
+    StillEncoder streaming(kWidth, kHeight, StillEncoder::Format::kRGBA,
+                           ReadLine, &image);
+    const Clock::time_point start = Clock::now();
+    while (streaming.Read(chunk.data(), chunk.size()) == chunk.size()) {
+    }
+    read_ns += Elapsed(start);
+    encoded = streaming.GetEncodedSize();
+  }
+
+  const size_t total = decoded * CONFIG_BENCHMARK_ITERATIONS;
+  printf("\n%s: %u bytes encoded into %u bytes (%.1fx)\n", image.name,
+         (unsigned)decoded, (unsigned)encoded, (double)decoded / encoded);
+  printf("  convert %8.1f MB/s\n", MBps(total, convert_ns));
+  printf("  rle     %8.1f MB/s\n", MBps(total, compress_ns));
+  printf("  read    %8.1f MB/s (includes copying the lines)\n",
+         MBps(total, read_ns));
+}
+
+extern "C" void app_main(void) {
+  printf("Encoding a %ux%u still %u times\n", kWidth, kHeight,
+         CONFIG_BENCHMARK_ITERATIONS);
+  std::vector<Image> images = CreateImages();
+  for (Image& image : images) Benchmark(image);
+}
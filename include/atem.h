@@ -9,19 +9,28 @@
 #include <arpa/inet.h>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/queue.h>
 #include <freertos/task.h>
+#include <freertos/timers.h>
 #include <lwip/netdb.h>
 #include <lwip/sockets.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <map>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "atem_command.h"
+#include "atem_journal.h"
 #include "atem_packet.h"
+#include "atem_parser.h"
 #include "atem_state.h"
 #include "atem_types.h"
+#include "seqlock.h"
 #include "sequence_check.h"
 
 namespace atem {
@@ -97,6 +106,28 @@ enum : int32_t {
   ATEM_EVENT_TRANSITION_STATE,
 };
 
+/**
+ * @brief The data of every ATEM_EVENT, it starts with the packet id so a
+ * handler can still read it as an uint16_t.
+ */
+struct AtemEventData {
+  /// The id of the last packet that has been parsed
+  uint16_t packet_id;
+  /**
+   * @brief Bitmask of the indices that have changed:
+   *  - ATEM_EVENT_SOURCE, _FADE_TO_BLACK, _TRANSITION_*: bit ME
+   *  - ATEM_EVENT_USK, _USK_DVE: bit ME * 16 + keyer
+   *  - ATEM_EVENT_DSK: bit keyer
+   *  - ATEM_EVENT_AUX: bit channel
+   *  - ATEM_EVENT_MEDIA_PLAYER: bit media player
+   *  - ATEM_EVENT_MEDIA_POOL: bit still
+   *
+   * All bits are set for other events, for the initial state and for indices
+   * that don't fit. When it's 0 the commands didn't change the state.
+   */
+  uint64_t dirty;
+};
+
 class Atem {
  public:
   /**
@@ -111,32 +142,63 @@ class Atem {
    * @brief Get the State Mutex
    *
    * @warning Make sure you give the mutex back within 20ms or 16ms (e.g. 1
-   * frame)
+   * frame), use GetStateSnapshot when the state is read often
    *
    * @return SemaphoreHandle_t
    */
   SemaphoreHandle_t GetStateMutex() const { return this->state_mutex_; }
+  /**
+   * @brief Get a copy of the most used state. This doesn't need the state
+   * mutex and never blocks the parser, so it can be called at any rate (e.g.
+   * from a tally or UI task).
+   *
+   * @return StateSnapshot
+   */
+  StateSnapshot GetStateSnapshot() const { return this->snapshot_.Read(); }
+  /**
+   * @brief Get the version of the snapshot, this changes every time a packet
+   * has been parsed.
+   *
+   * @return uint32_t
+   */
+  uint32_t GetStateVersion() const { return this->snapshot_.GetVersion(); }
+  /**
+   * @brief Get the fields of the state that have changed since the last call,
+   * see ChangeJournal::GetChangesSince. This doesn't need the state mutex.
+   *
+   * @param cursor[in,out] The sequence up to which the changes have been
+   * read, 0 for a new reader
+   * @param changes[out] Where to store the changes
+   * @param length[in] The maximum amount of changes to return
+   * @param behind[out] Changes have been missed (e.g. after a reconnect), the
+   * full state has to be read
+   * @return size_t The amount of changes stored in changes
+   */
+  size_t GetChangesSince(uint32_t& cursor, Change* changes, size_t length,
+                         bool& behind) {
+    return this->journal_.GetChangesSince(cursor, changes, length, behind);
+  }
 
   // MARK: Direct state
 
   /**
-   * @brief Get the map of input properties
+   * @brief Get the table of input properties
    *
    * @warning Make sure your task has ownership over the atem state
    *
-   * @return const std::map<Source, InputProperty> &
+   * @return const InputTable& The properties ordered by source
    */
-  const std::map<Source, AtemState<InputProperty>>& GetInputProperties() const {
-    return this->input_properties_;
+  const InputTable& GetInputProperties() const {
+    return this->switcher_.input_properties;
   }
 
-  const std::vector<Dsk>& GetDsk() const { return this->dsk_; }
+  const std::vector<Dsk>& GetDsk() const { return this->switcher_.dsk; }
   const std::vector<MixEffect>& GetMixEffect() const {
-    return this->mix_effect_;
+    return this->switcher_.mix_effect;
   }
   const std::vector<AtemState<MediaPlayerSource>>& GetMediaPlayerSources()
       const {
-    return this->media_player_source_;
+    return this->switcher_.media_player_source;
   }
 
   /**
@@ -148,29 +210,86 @@ class Atem {
    * @return Source*
    */
   const std::vector<AtemState<Source>>& GetAuxOutputs() const {
-    return this->aux_out_;
+    return this->switcher_.aux_out;
   }
 
   /**
-   * @brief Get the map of the Media Player File Names
+   * @brief Get the file names of the stills in the media pool
    *
    * @warning Make sure your task has ownership over the atem state
    *
-   * @return const std::map<uint16_t, char*> {index, file name}
+   * @return const StringArena& The file name of every still index, nullptr
+   * when the still isn't used
    */
-  const std::map<uint16_t, AtemState<char*>>& GetMediaPlayerFileName() const {
-    return this->media_player_file_;
+  const StringArena& GetMediaPlayerFileName() const {
+    return this->switcher_.media_player_file;
   }
 
   // MARK: Parced state
 
   /**
-   * @brief Returns if the atem connection is active or not
+   * @brief Returns if the atem connection is active and its initial state has
+   * been swapped in
    *
-   * @return true The connection is active.
+   * @return true The connection is active and the state can be read
    * @return false The connection isn't active
    */
-  bool Connected() const { return this->state_ == ConnectionState::kActive; }
+  bool Connected() const {
+    return this->state_ready_.load(std::memory_order_acquire);
+  }
+  /**
+   * @brief Get the time it took to receive the initial state of the ATEM,
+   * measured from the INIT request to the moment the state became available.
+   *
+   * @return uint32_t The time in ms, 0 when the connection isn't active
+   */
+  uint32_t GetTimeToReady() const {
+    return this->Connected() ? pdTICKS_TO_MS(this->time_to_ready_) : 0;
+  }
+#if CONFIG_ATEM_STORE_SEND
+  /**
+   * @brief The round trip time of send packets, as measured from the ACKs of
+   * the ATEM. All times are in us.
+   */
+  struct RttStats {
+    // Smoothed round trip time
+    uint32_t srtt;
+    // Variation of the round trip time
+    uint32_t rttvar;
+    // Time after which an unacknowledged packet is send again
+    uint32_t rto;
+    // Amount of measurements
+    uint32_t samples;
+    // Amount of packets that have been send again because of a timeout
+    uint32_t retransmits;
+  };
+  /**
+   * @brief Get the round trip time statistics of the current connection
+   *
+   * @return RttStats A copy of the statistics
+   */
+  RttStats GetRttStats() const;
+  /**
+   * @brief The state of the send window
+   */
+  struct TxStats {
+    // Packets and bytes that are send but not acknowledged
+    uint16_t inflight_packets;
+    uint32_t inflight_bytes;
+    // Amount of times the transmit task had to wait for an ACK
+    uint32_t window_full;
+    // Amount of packets that were rejected because the queue was full
+    uint32_t queue_full;
+    // Amount of packets waiting in the transmit queue
+    uint32_t queued;
+  };
+  /**
+   * @brief Get the state of the send window
+   *
+   * @return TxStats A copy of the statistics
+   */
+  TxStats GetTxStats() const;
+#endif
   /**
    * @brief Get the source that's currently displayed of the aux channel. It
    * will return false when it's invalid.
@@ -258,7 +377,7 @@ class Atem {
    *
    * @return const char*
    */
-  const char* GetProductId() const { return this->product_id_; }
+  const char* GetProductId() const { return this->switcher_.product_id; }
   /**
    * @brief Get the current program source active on ME
    *
@@ -357,6 +476,214 @@ class Atem {
    * @return If the packet was send (added to queue) successfully
    */
   esp_err_t SendCommands(const std::vector<AtemCommand*>& commands);
+  /**
+   * @brief Send commands to the ATEM without allocating the commands, the
+   * length of the packet is calculated at compile time.
+   *
+   * @code
+   *  atem_connection->SendCommands(atem::cmd::Cut(0), atem::cmd::Auto(1));
+   * @endcode
+   *
+   * @param commands[in] One or more commands derived from FixedCommand
+   *
+   * @return If the packet was send (added to queue) successfully
+   */
+  template <typename... Commands>
+    requires(sizeof...(Commands) != 0 &&
+             (std::is_base_of_v<AtemCommand, std::decay_t<Commands>> && ...))
+  esp_err_t SendCommands(Commands&&... commands) {
+    constexpr uint16_t length = 12 + (std::decay_t<Commands>::kLength + ...);
+    static_assert(length <= CONFIG_PACKET_BUFFER_SIZE,
+                  "The commands don't fit in a single packet");
+
+    AtemPacket packet = this->CreatePacket_(commands...);
+    if (unlikely(packet.GetData() == nullptr)) return ESP_ERR_NO_MEM;
+
+    return this->QueuePacket_(std::move(packet));
+  }
+
+  /**
+   * @brief The maximum length of a packet that is send with multiple commands
+   * (e.g. merged or with chunks of MediaUpload). It fits in the MTU of
+   * Ethernet without fragmenting, and in a large buffer of the packet pool.
+   */
+  static constexpr uint16_t kTxMtu =
+      std::min<size_t>(1400, PacketPool::kLargeSize);
+
+  /**
+   * @brief Called once the ATEM acknowledged a packet, or when it's certain
+   * that it won't be acknowledged. It's called exactly once for every packet
+   * that has been queued, also when the Atem is destroyed. Requires
+   * ATEM_STORE_SEND.
+   *
+   * @warning This is executed inside one of the background tasks or the timer
+   * task, do not block.
+   *
+   * @param result[in] ESP_OK when acknowledged, ESP_ERR_TIMEOUT when there was
+   * no ACK within ATEM_ACK_TIMEOUT ms, ESP_ERR_INVALID_STATE when the
+   * connection was reset and ESP_FAIL when the packet was removed from the
+   * store before it was acknowledged
+   * @param latency[in] The time from sending the packet until the ACK, in us
+   * @param arg[in] The argument given to SendCommands
+   */
+  typedef void (*AckCallback)(esp_err_t result, uint32_t latency, void* arg);
+
+#if CONFIG_ATEM_STORE_SEND
+  /**
+   * @brief Send multiple commands in a single packet and call a function once
+   * the ATEM has acknowledged the packet. With ATEM_TX_BATCHING the packet
+   * can be merged with the packets of other calls, every callback is then
+   * called with the result of the merged packet.
+   *
+   * @code
+   *  atem_connection->SendCommands(on_cut_done, nullptr, atem::cmd::Cut(0));
+   * @endcode
+   *
+   * @param callback[in] The function to call, only called when ESP_OK is
+   * returned
+   * @param arg[in] The argument passed to the callback
+   * @param commands[in] One or more commands derived from FixedCommand
+   *
+   * @return If the packet was send (added to queue) successfully
+   */
+  template <typename... Commands>
+    requires(sizeof...(Commands) != 0 &&
+             (std::is_base_of_v<AtemCommand, std::decay_t<Commands>> && ...))
+  esp_err_t SendCommands(AckCallback callback, void* arg,
+                         Commands&&... commands) {
+    AtemPacket packet = this->CreatePacket_(commands...);
+    if (unlikely(packet.GetData() == nullptr)) return ESP_ERR_NO_MEM;
+
+    return this->QueuePacket_(std::move(packet), callback, arg);
+  }
+  /**
+   * @brief Send multiple commands in a single packet and call a function once
+   * the ATEM has acknowledged the packet, see SendCommands.
+   *
+   * @param callback[in] The function to call, only called when ESP_OK is
+   * returned
+   * @param arg[in] The argument passed to the callback
+   * @param commands[in] The commands to send, these are deleted
+   *
+   * @return If the packet was send (added to queue) successfully
+   */
+  esp_err_t SendCommands(AckCallback callback, void* arg,
+                         const std::vector<AtemCommand*>& commands);
+  /**
+   * @brief Send a packet with commands that have been written into it by the
+   * caller (e.g. data that's read directly into the packet), see SendCommands.
+   *
+   * @code
+   *  atem::AtemPacket packet(0x1, 0, 12 + length);
+   *  // Write the commands at (uint8_t*)packet.GetData() + 12
+   *  atem_connection->SendPacket(std::move(packet), on_done, nullptr);
+   * @endcode
+   *
+   * @param packet[in] A packet with the 0x1 flag, the session and id are set
+   * when it's send. PrepairCommand isn't called for the commands.
+   * @param callback[in] The function to call, only called when ESP_OK is
+   * returned
+   * @param arg[in] The argument passed to the callback
+   *
+   * @return If the packet was send (added to queue) successfully
+   */
+  esp_err_t SendPacket(AtemPacket&& packet, AckCallback callback, void* arg) {
+    return this->QueuePacket_(std::move(packet), callback, arg);
+  }
+  /**
+   * @brief Send multiple commands in a single packet and wait until the ATEM
+   * has acknowledged it.
+   *
+   * @code
+   *  atem_connection->SendCommandsAndWait(nullptr, atem::cmd::Cut(0));
+   *  atem_connection->SendCommandsAndWait(nullptr, atem::cmd::Auto(0));
+   * @endcode
+   *
+   * @param latency[out] The time from sending the packet until the ACK in us,
+   * can be nullptr
+   * @param commands[in] One or more commands derived from FixedCommand
+   *
+   * @return esp_err_t The result of sending, or the result passed to the
+   * AckCallback
+   */
+  template <typename... Commands>
+    requires(sizeof...(Commands) != 0 &&
+             (std::is_base_of_v<AtemCommand, std::decay_t<Commands>> && ...))
+  esp_err_t SendCommandsAndWait(uint32_t* latency, Commands&&... commands) {
+    StaticSemaphore_t done_buffer;
+    AckWait wait = {xSemaphoreCreateBinaryStatic(&done_buffer), ESP_FAIL, 0};
+
+    esp_err_t ret = this->SendCommands(&Atem::AckWaitCallback_, &wait,
+                                       std::forward<Commands>(commands)...);
+    if (ret == ESP_OK) {
+      // The callback is always called, at the latest after ATEM_ACK_TIMEOUT ms
+      xSemaphoreTake(wait.done, portMAX_DELAY);
+      ret = wait.result;
+      if (latency != nullptr) *latency = wait.latency;
+    }
+
+    vSemaphoreDelete(wait.done);
+    return ret;
+  }
+#endif
+
+  /**
+   * @brief Queue a command of a continuous control (e.g. a fader), all queued
+   * commands are send in a single packet every ATEM_COALESCE_INTERVAL ms. When
+   * a command with the same identity is already queued it's replaced, only the
+   * latest value is send.
+   *
+   * @code
+   *  atem_connection->QueueCommand(atem::cmd::TransitionPosition(pos, 0));
+   * @endcode
+   *
+   * @param command[in] The command to queue, see AtemCommand::GetCoalesceKey
+   *
+   * @return ESP_ERR_NO_MEM when the queue is full, ESP_ERR_INVALID_SIZE when
+   * the command is to large
+   */
+  esp_err_t QueueCommand(AtemCommand&& command);
+
+  /**
+   * @brief A function that is called for every received command it has been
+   * registered for.
+   *
+   * @warning This is executed inside the background task while parsing the
+   * packet, the command is only valid during the call. Do not block and do
+   * not (un)register hooks from inside the hook.
+   *
+   * @param command[in] A view into the received packet
+   * @param arg[in] The argument given while registering the hook
+   */
+  typedef void (*CommandHook)(AtemCommand& command, void* arg);
+
+  /**
+   * @brief Register a hook that is called for every received command with a
+   * specific cmd. This can be used to process commands that aren't parsed by
+   * this library.
+   *
+   * @code
+   *  atem_connection->RegisterCommandHook("AMLv", audio_levels, nullptr);
+   * @endcode
+   *
+   * @param cmd[in] The 4 character cmd (e.g. "AMLv")
+   * @param hook[in] The function to call
+   * @param arg[in] The argument passed to the hook
+   *
+   * @return ESP_ERR_NO_MEM when CONFIG_ATEM_COMMAND_HOOKS hooks are registered
+   */
+  esp_err_t RegisterCommandHook(const char* cmd, CommandHook hook, void* arg);
+  /**
+   * @brief Remove a hook that has been registered with RegisterCommandHook
+   *
+   * @param cmd[in] The 4 character cmd (e.g. "AMLv")
+   * @param hook[in] The function that was registered
+   * @param arg[in] The argument that was registered
+   *
+   * @return ESP_ERR_NOT_FOUND when the hook wasn't registered
+   */
+  esp_err_t UnregisterCommandHook(const char* cmd, CommandHook hook,
+                                  void* arg);
 
  protected:
   int sockfd_;
@@ -370,35 +697,378 @@ class Atem {
   };
   ConnectionState state_{ConnectionState::kNotConnected};
   uint16_t session_id_;
-  uint16_t local_id_{0};
+  // The id of the last packet send, only written by the transmit task (see
+  // NextLocalId_), the other tasks request a reset with local_id_reset_
+  std::atomic<uint16_t> local_id_{0};
+  std::atomic<bool> local_id_reset_{false};
   uint16_t remote_id_{0};
+  TickType_t init_tick_{0};
+  TickType_t time_to_ready_{0};
+  // Set by the parser task once the initial state is swapped in, cleared on
+  // every reconnect
+  std::atomic<bool> state_ready_{false};
 
   // Check missing packets
   SequenceCheck sqeuence_;
 
+#if CONFIG_ATEM_DELAYED_ACK
+  // Received packets that haven't been acknowledged yet
+  uint8_t ack_pending_{0};
+  int64_t ack_time_{0};
+  /**
+   * @brief Acknowledge all packets that have been received in order.
+   */
+  void SendAck_();
+#endif
+
+  // A callback of a packet and its argument
+  struct AckTarget {
+    AckCallback callback;
+    void* arg;
+  };
+#if CONFIG_ATEM_TX_BATCHING
+  // Callbacks kept for a single packet, a packet with a callback is only
+  // merged when there is room for it
+  static constexpr size_t kMaxCallbacks = 4;
+#else
+  static constexpr size_t kMaxCallbacks = 1;
+#endif
+
 // Packets send
 #if CONFIG_ATEM_STORE_SEND
+  static_assert((CONFIG_ATEM_STORE_SEND_SIZE &
+                 (CONFIG_ATEM_STORE_SEND_SIZE - 1)) == 0,
+                "ATEM_STORE_SEND_SIZE must be a power of two");
   SemaphoreHandle_t send_mutex_{xSemaphoreCreateMutex()};
-  std::vector<AtemPacket*> send_packets_;
+  // Packets that haven't been acknowledged, indexed by id & (size - 1)
+  AtemPacket send_packets_[CONFIG_ATEM_STORE_SEND_SIZE];
+  // All packets up to and including this id have been acknowledged
+  int16_t send_acked_id_{0};
+  /**
+   * @brief Get the stored packet with an id
+   * @warning The send mutex must be locked
+   *
+   * @param id[in] The id of the packet
+   * @return AtemPacket* nullptr when the packet isn't stored
+   */
+  AtemPacket* GetSendPacket_(int16_t id) {
+    AtemPacket& p =
+        this->send_packets_[id & (CONFIG_ATEM_STORE_SEND_SIZE - 1)];
+    return p.GetData() != nullptr && p.GetId() == id ? &p : nullptr;
+  }
+  // Information about the packet in the same slot of send_packets_
+  struct SendInfo {
+    // The time the packet was first and last send, in us
+    int64_t first;
+    int64_t last;
+    // Packets that have been send again aren't used to measure the round
+    // trip time, it's unknown which one is acknowledged (Karn's algorithm)
+    bool retransmitted;
+    // Called once the packet is acknowledged, one for every merged packet
+    // that has a callback
+    uint8_t callback_count;
+    AckTarget callbacks[kMaxCallbacks];
+  };
+  SendInfo send_info_[CONFIG_ATEM_STORE_SEND_SIZE]{};
+  // A callback that has been taken from a SendInfo, callbacks are called
+  // after the send mutex has been given back
+  struct AckResult {
+    AckCallback callback;
+    void* arg;
+    esp_err_t result;
+    uint32_t latency;
+  };
+  // Only the packets in the send window are stored, so this fits the
+  // callbacks of all stored packets
+  static constexpr size_t kMaxAckResults =
+      CONFIG_ATEM_TX_WINDOW_PACKETS * kMaxCallbacks;
+  /**
+   * @brief Take the callbacks of a stored packet
+   * @warning The send mutex must be locked
+   *
+   * @param slot[in] The slot of the packet
+   * @param result[in] The result to report
+   * @param now[in] The current time in us
+   * @param out[out] Where the callbacks are appended
+   * @param count[in,out] The amount of callbacks in out
+   */
+  void TakeCallbacks_(size_t slot, esp_err_t result, int64_t now,
+                      AckResult* out, size_t& count);
+  // Used by SendCommandsAndWait
+  struct AckWait {
+    SemaphoreHandle_t done;
+    esp_err_t result;
+    uint32_t latency;
+  };
+  static void AckWaitCallback_(esp_err_t result, uint32_t latency, void* arg);
+  RttStats rtt_{0, 0, CONFIG_ATEM_RTO_MAX * 1000, 0, 0};
+  static_assert(CONFIG_ATEM_TX_WINDOW_PACKETS <= CONFIG_ATEM_STORE_SEND_SIZE,
+                "ATEM_TX_WINDOW_PACKETS must fit in the send store");
+  // queue_full and queued are only filled in by GetTxStats
+  TxStats tx_{0, 0, 0, 0, 0};
+  std::atomic<uint32_t> queue_full_{0};
+  /**
+   * @brief Wait until a packet fits in the send window, this is woken up by
+   * every ACK
+   *
+   * @param length[in] The length of the packet
+   */
+  void WaitForWindow_(uint16_t length);
+  // Sends unacknowledged packets again once the oldest one timed out
+  TimerHandle_t rto_timer_{nullptr};
+  /**
+   * @brief Add a measurement to the round trip time, as described in RFC 6298
+   * @warning The send mutex must be locked
+   *
+   * @param rtt[in] The measured round trip time in us
+   */
+  void UpdateRtt_(uint32_t rtt);
+  /**
+   * @brief (Re)start the retransmission timer with the current timeout
+   */
+  void StartRtoTimer_();
+  /**
+   * @brief Send all packets again that haven't been acknowledged within the
+   * retransmission timeout
+   */
+  void RetransmitExpired_();
+  /**
+   * @brief Remove all stored packets
+   */
+  void ClearSendPackets_();
 #endif
 
   // ATEM state
   SemaphoreHandle_t state_mutex_{xSemaphoreCreateMutex()};
-  std::map<Source, AtemState<InputProperty>> input_properties_;
-  AtemState<Topology> topology_;
-  AtemState<ProtocolVersion> version_;
-  AtemState<MediaPlayer> media_player_;
-  char product_id_[45] = {0};
-  std::vector<MixEffect> mix_effect_;
-  std::vector<Dsk> dsk_;
-  std::vector<AtemState<Source>> aux_out_;
-  std::vector<AtemState<MediaPlayerSource>> media_player_source_;
-  std::map<uint16_t, AtemState<char*>> media_player_file_;
-  AtemState<StreamState> stream_{StreamState::IDLE};
+  SwitcherState switcher_;
+  // The initial state, only used by the parser task until it's swapped in
+  SwitcherState staging_;
+  // A copy of switcher_ that can be read without the state mutex
+  SeqLock<StateSnapshot> snapshot_;
+  // The fields of switcher_ changed by the parser
+  ChangeJournal journal_;
+
+  // A packet waiting for the transmit task
+  struct TxItem {
+    // The buffer of a packet without an id (see AtemPacket::Detach), nullptr
+    // for a keepalive
+    void* data;
+    AckCallback callback;
+    void* arg;
+  };
+  QueueHandle_t tx_queue_{nullptr};
+  TaskHandle_t tx_task_handle_{nullptr};
+  /**
+   * @brief Gives every queued packet the next id and sends it, no other task
+   * sends packets with an id.
+   */
+  void tx_task_();
+  // Time the last packet was send, used for pacing
+  int64_t tx_last_{0};
+  /**
+   * @brief Hand a packet to the transmit task, this never blocks on the
+   * socket.
+   *
+   * @param packet[in] The packet to send, this must have the 0x1 flag
+   * @param callback[in] Called once the packet is acknowledged, only when
+   * ESP_OK is returned and ATEM_STORE_SEND is enabled
+   * @param arg[in] The argument passed to the callback
+   * @param wait[in] Time to wait for room in the queue
+   * @return esp_err_t ESP_ERR_NO_MEM when the queue is full
+   */
+  esp_err_t QueuePacket_(
+      AtemPacket&& packet, AckCallback callback = nullptr, void* arg = nullptr,
+      TickType_t wait = pdMS_TO_TICKS(CONFIG_ATEM_TX_QUEUE_WAIT));
+  /**
+   * @brief Pace, give the packet the current session and send it
+   * @warning Only used by the transmit task
+   *
+   * @param packet[in] The packet to send, this must have the 0x1 flag
+   * @param callbacks[in] Called once the packet is acknowledged
+   * @param count[in] The amount of callbacks
+   */
+  void Transmit_(AtemPacket&& packet, const AckTarget* callbacks,
+                 size_t count);
+#if CONFIG_ATEM_TX_BATCHING
+  /**
+   * @brief Send a packet together with the packets that are queued within
+   * ATEM_TX_BATCH_WINDOW ms, merged into a single packet. When the merged
+   * packet can't be allocated every packet is send on its own.
+   *
+   * @param packet[in] The first packet
+   * @param target[in] The callback of the first packet
+   */
+  void SendMerged_(AtemPacket&& packet, const AckTarget& target);
+#endif
+  /**
+   * @brief Get the next id for a packet that requests an ACK
+   * @warning Only used by the transmit task
+   *
+   * @return uint16_t
+   */
+  uint16_t NextLocalId_() {
+    uint16_t id = this->local_id_.load(std::memory_order_relaxed);
+    if (this->local_id_reset_.exchange(false, std::memory_order_acquire))
+      id = 0;
+
+    // Stored masked, so it can be compared with the id of an ACK
+    id = (id + 1) & 0x7FFF;
+    this->local_id_.store(id, std::memory_order_relaxed);
+    return id;
+  }
+
+  // Commands waiting to be coalesced, in the order they are queued
+  static constexpr uint16_t kMaxCoalesceLength = 72;
+  struct CoalesceEntry {
+    uint32_t cmd;
+    uint32_t key;
+    alignas(4) uint8_t data[kMaxCoalesceLength];
+  };
+  SemaphoreHandle_t coalesce_mutex_{xSemaphoreCreateMutex()};
+  CoalesceEntry coalesce_[CONFIG_ATEM_COALESCE_SLOTS];
+  size_t coalesce_count_{0};
+  TimerHandle_t coalesce_timer_{nullptr};
+  /**
+   * @brief Send all commands in the coalescing queue
+   */
+  void FlushCoalesced_();
+
+  // Command hooks, sorted by cmd
+  struct CommandHookEntry {
+    uint32_t cmd;
+    CommandHook hook;
+    void* arg;
+  };
+  SemaphoreHandle_t hook_mutex_{xSemaphoreCreateMutex()};
+  CommandHookEntry hooks_[CONFIG_ATEM_COMMAND_HOOKS];
+  size_t hook_count_{0};
 
   TaskHandle_t task_handle_{nullptr};
   void task_();
 
+  // Received packets that are waiting for the parser task, this is a single
+  // producer (task_) single consumer (parse_task_) ring. One slot is always
+  // free, that's the slot the next packet is received in.
+  enum class RxSlotType : uint8_t {
+    kStaged,  // Part of the initial state
+    kLive,    // An update of the state
+    kReady,   // The initial state is complete
+  };
+  struct RxSlot {
+    RxSlotType type;
+    int16_t id;
+    // The connection the packet was received on, see generation_
+    uint32_t generation;
+  };
+  char* rx_buffer_{nullptr};
+  RxSlot rx_slots_[CONFIG_ATEM_RX_RING_SIZE];
+  std::atomic<size_t> rx_head_{0};
+  std::atomic<size_t> rx_tail_{0};
+  // Incremented on every reconnect, so old packets are never parsed
+  std::atomic<uint32_t> generation_{0};
+
+  TaskHandle_t parse_task_handle_{nullptr};
+  void parse_task_();
+  /**
+   * @brief Get the buffer of a slot in the receive ring
+   *
+   * @param i[in] The index of the slot
+   * @return AtemPacket
+   */
+  AtemPacket GetRxPacket_(size_t i) {
+    return AtemPacket(this->rx_buffer_ + i * CONFIG_PACKET_BUFFER_SIZE);
+  }
+
+  /**
+   * @brief Handle the protocol part of a received packet (INIT, ACK, RESEND).
+   *
+   * @param packet[in] The received packet
+   * @param len[in] The amount of bytes received
+   * @param room[in] Whether there is a slot to parse the packet in, a packet
+   * with commands isn't acknowledged without one
+   * @return true When the packet contains commands that should be parsed
+   */
+  bool HandlePacket_(AtemPacket& packet, int len, bool room);
+  /**
+   * @brief Parse all commands inside a packet into a state
+   * @warning The state mutex must be locked when parsing into switcher_
+   *
+   * @param packet[in] The packet to parse
+   * @param context[in,out] The state to parse the commands into and the
+   * packet id, the events and changed indices are added to it
+   */
+  void ParsePacket_(AtemPacket& packet, parser::Context& context);
+  /**
+   * @brief Make the initial state available and post all events.
+   *
+   * @param id[in] The last packet id of the initial state
+   */
+  void SwapInState_(int16_t id);
+  /**
+   * @brief Copy switcher_ into the snapshot
+   * @warning The state mutex must be locked
+   *
+   * @param id[in] The id of the last parsed packet
+   */
+  void PublishSnapshot_(int16_t id);
+  /**
+   * @brief Call all hooks that are registered for a command
+   * @warning The hook mutex must be locked
+   *
+   * @param cmd[in] The cmd of the command, created using ATEM_CMD
+   * @param command[in] The received command
+   */
+  void RunCommandHooks_(uint32_t cmd, AtemCommand& command);
+
+  /**
+   * @brief Send a list of heap allocated commands in a single packet
+   *
+   * @param commands[in] The commands to send, these are deleted
+   * @param callback[in] Called once the packet is acknowledged
+   * @param arg[in] The argument passed to the callback
+   * @return esp_err_t
+   */
+  esp_err_t SendCommandList_(const std::vector<AtemCommand*>& commands,
+                             AckCallback callback, void* arg);
+  /**
+   * @brief Create a packet containing multiple commands
+   *
+   * @param commands[in] One or more commands derived from FixedCommand
+   * @return AtemPacket The packet without an id, check GetData for nullptr
+   */
+  template <typename... Commands>
+  AtemPacket CreatePacket_(Commands&... commands) {
+    constexpr uint16_t length = 12 + (std::decay_t<Commands>::kLength + ...);
+    AtemPacket packet(0x1, this->session_id_, length);
+    if (unlikely(packet.GetData() == nullptr)) return packet;
+
+    // Copy commands into packet
+    const ProtocolVersion version = this->switcher_.version.Get();
+    uint8_t* data = (uint8_t*)packet.GetData() + 12;
+    ((commands.PrepairCommand(version),
+      memcpy(data, commands.GetRawData(), std::decay_t<Commands>::kLength),
+      data += std::decay_t<Commands>::kLength),
+     ...);
+
+    return packet;
+  }
+  /**
+   * @brief Give the packet an id, send it and store it so it can be resend.
+   * @warning Only used by the transmit task
+   *
+   * @param packet[in] The packet to send, this must have the 0x1 flag
+   * @param callbacks[in] Called once the packet is acknowledged (at most
+   * kMaxCallbacks)
+   * @param count[in] The amount of callbacks
+   * @return esp_err_t
+   */
+#if CONFIG_ATEM_STORE_SEND
+  esp_err_t SendStoredPacket_(AtemPacket&& packet,
+                              const AckTarget* callbacks = nullptr,
+                              size_t count = 0);
+#else
+  esp_err_t SendStoredPacket_(AtemPacket&& packet);
+#endif
   /**
    * @brief Send an AtemPacket to the atem
    * @warning The packet is not deallocated
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <cstring>
 #include <initializer_list>
 #include <tuple>
 
@@ -49,13 +51,24 @@ class AtemCommand {
    */
   virtual void PrepairCommand(const ProtocolVersion &ver) {}
 
+  /// The key of a command that can't be coalesced
+  static constexpr uint32_t kUnique = UINT32_MAX;
+  /**
+   * @brief Get the identity of the command without its value (e.g. the ME and
+   * keyer it's for). Queued commands with the same cmd and key replace each
+   * other, see Atem::QueueCommand.
+   *
+   * @return uint32_t kUnique when the command can't be coalesced
+   */
+  virtual uint32_t GetCoalesceKey() const { return kUnique; }
+
   /**
    * @brief Get the length of the command, this include the 8 bytes for the
    * header
    *
    * @return uint16_t
    */
-  uint16_t GetLength() { return ntohs(((uint16_t *)this->data_)[0]); }
+  uint16_t GetLength() const { return ntohs(((uint16_t *)this->data_)[0]); }
   /**
    * @brief Get the cmd, this isn't null terminated
    *
@@ -103,7 +116,60 @@ class AtemCommand {
    */
   template <typename T>
   T GetDataL(size_t i) {
-    return (T)ntohl(((uint16_t *)this->data_)[2 + i]);
+    return (T)ntohl(((uint32_t *)this->data_)[2 + i]);
+  }
+  /**
+   * @brief Read a value from the data (excluding the header) at any byte
+   * offset. This function auto converts from network order to host order.
+   *
+   * @warning The offset isn't checked against the length, use a Layout for
+   * that.
+   *
+   * @tparam T A type of 1, 2 or 4 bytes
+   * @param offset[in] The offset in bytes
+   * @return T
+   */
+  template <typename T>
+  T Read(uint16_t offset) const {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4,
+                  "Only 1, 2 or 4 byte values can be read");
+    const uint8_t *data = (const uint8_t *)this->data_ + 8 + offset;
+
+    if constexpr (sizeof(T) == 1) {
+      return (T)data[0];
+    } else if constexpr (sizeof(T) == 2) {
+      uint16_t value;
+      memcpy(&value, data, sizeof(value));
+      return (T)ntohs(value);
+    } else {
+      uint32_t value;
+      memcpy(&value, data, sizeof(value));
+      return (T)ntohl(value);
+    }
+  }
+  /**
+   * @brief Write a value into the data (excluding the header) at any byte
+   * offset. This function auto converts from host order to network order.
+   *
+   * @tparam T A type of 1, 2 or 4 bytes
+   * @param offset[in] The offset in bytes
+   * @param value[in] The value to write
+   */
+  template <typename T>
+  void Write(uint16_t offset, T value) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4,
+                  "Only 1, 2 or 4 byte values can be written");
+    uint8_t *data = (uint8_t *)this->data_ + 8 + offset;
+
+    if constexpr (sizeof(T) == 1) {
+      data[0] = (uint8_t)value;
+    } else if constexpr (sizeof(T) == 2) {
+      const uint16_t v = htons((uint16_t)value);
+      memcpy(data, &v, sizeof(v));
+    } else {
+      const uint32_t v = htonl((uint32_t)value);
+      memcpy(data, &v, sizeof(v));
+    }
   }
   /**
    * @brief Get the access to the raw buffer, use GetLength to get the size of
@@ -111,26 +177,267 @@ class AtemCommand {
    *
    * @return const void*
    */
-  const void *GetRawData() { return this->data_; }
+  const void *GetRawData() const { return this->data_; }
 
  protected:
   bool has_alloc_{true};
   void *data_;
 };
 
+/**
+ * @brief Storage of a FixedCommand, this is a separate base so it's
+ * initialized before AtemCommand.
+ */
+template <uint16_t Length>
+struct CommandBuffer {
+  alignas(4) uint8_t buffer_[Length] = {0};
+};
+
+/**
+ * @brief A command with a length known at compile time, the data is stored
+ * inside the object so creating it never allocates memory.
+ *
+ * @tparam Length Length of the command, including the header (8 bytes)
+ */
+template <uint16_t Length>
+class FixedCommand : private CommandBuffer<Length>, public AtemCommand {
+ public:
+  static constexpr uint16_t kLength = Length;
+
+  FixedCommand(const char *cmd) : AtemCommand(this->buffer_) {
+    ((uint16_t *)this->buffer_)[0] = htons(Length);
+    memcpy(this->buffer_ + 4, cmd, 4);
+  }
+  FixedCommand(const FixedCommand &other)
+      : CommandBuffer<Length>(other), AtemCommand(this->buffer_) {}
+  FixedCommand &operator=(const FixedCommand &other) {
+    memcpy(this->buffer_, other.buffer_, Length);
+    return *this;
+  }
+};
+
+/**
+ * @brief A single big endian value inside the data of a command.
+ *
+ * @tparam T The type of the value (1, 2 or 4 bytes)
+ * @tparam Offset The offset in bytes, excluding the header
+ */
+template <typename T, uint16_t Offset>
+struct Field {
+  typedef T Type;
+  static constexpr uint16_t kEnd = Offset + sizeof(T);
+
+  static T Read(const AtemCommand &command) {
+    return command.Read<T>(Offset);
+  }
+  static void Write(AtemCommand &command, const T &value) {
+    command.Write<T>(Offset, value);
+  }
+};
+
+/**
+ * @brief A fixed size string inside the data of a command, this string
+ * doesn't have to be null terminated.
+ *
+ * @tparam Offset The offset in bytes, excluding the header
+ * @tparam Length The maximum length of the string
+ */
+template <uint16_t Offset, uint16_t Length>
+struct String {
+  typedef const char *Type;
+  static constexpr uint16_t kEnd = Offset + Length;
+
+  static const char *Read(const AtemCommand &command) {
+    return (const char *)command.GetRawData() + 8 + Offset;
+  }
+  static void Write(AtemCommand &command, const char *value) {
+    strncpy(command.GetData<char *>() + Offset, value, Length);
+  }
+};
+
+/**
+ * @brief Describes where the fields of a command are stored. The same layout
+ * is used to decode a received command and to encode a command that will be
+ * send.
+ *
+ * @code
+ *  using MeSource = Layout<Field<uint8_t, 0>, Field<Source, 2>>;
+ *
+ *  uint8_t me;
+ *  Source source;
+ *  if (!MeSource::Decode(command, me, source)) return;
+ * @endcode
+ *
+ * @tparam Fields A list of Field or String
+ */
+template <typename... Fields>
+struct Layout {
+  /// The minimal length of the command (including the header)
+  static constexpr uint16_t kLength =
+      8 + std::max<uint16_t>({0, Fields::kEnd...});
+
+  /**
+   * @brief Decode all fields of a command, the length of the command is only
+   * checked once.
+   *
+   * @param command[in] The command to decode
+   * @param values[out] A variable for every field
+   * @return true When the command is long enough to contain all fields
+   */
+  static bool Decode(const AtemCommand &command,
+                     typename Fields::Type &...values) {
+    if (command.GetLength() < kLength) return false;
+    ((values = Fields::Read(command)), ...);
+    return true;
+  }
+  /**
+   * @brief Encode all fields into a command
+   *
+   * @param command[out] The command to encode in, this must be at least
+   * kLength long
+   * @param values[in] A value for every field
+   */
+  static void Encode(AtemCommand &command,
+                     const typename Fields::Type &...values) {
+    (Fields::Write(command, values), ...);
+  }
+};
+
+namespace layout {
+
+/// PrgI, PrvI, CPgI, CPvI
+typedef Layout<Field<uint8_t, 0>, Field<Source, 2>> MeSource;
+/// DskB
+typedef Layout<Field<uint8_t, 0>, Field<Source, 2>, Field<Source, 4>>
+    DskSource;
+/// CDsF, CDsC
+typedef Layout<Field<uint8_t, 0>, Field<Source, 2>> DskInput;
+/// CDsL, CDsT, DskP
+typedef Layout<Field<uint8_t, 0>, Field<bool, 1>> DskFlag;
+/// DskS
+typedef Layout<Field<uint8_t, 0>, Field<bool, 1>, Field<bool, 2>,
+               Field<bool, 3>>
+    DskState;
+/// AuxS
+typedef Layout<Field<uint8_t, 0>, Field<Source, 2>> AuxSelect;
+/// CAuS
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<Source, 2>>
+    AuxInput;
+/// DAut, DCut, FtbA
+typedef Layout<Field<uint8_t, 0>> Me;
+/// FtbS
+typedef Layout<Field<uint8_t, 0>, Field<bool, 1>, Field<bool, 2>> FadeToBlack;
+/// InPr
+typedef Layout<Field<Source, 0>, String<2, 20>, String<22, 4>> InputProperty;
+/// LOCK, LKST
+typedef Layout<Field<uint16_t, 0>, Field<bool, 2>> LockState;
+/// LKOB
+typedef Layout<Field<uint16_t, 0>> LockObtained;
+/// KeBP
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>,
+               Field<Source, 6>, Field<Source, 8>, Field<int16_t, 12>,
+               Field<int16_t, 14>, Field<int16_t, 16>, Field<int16_t, 18>>
+    UskProperties;
+/// KeDV
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<int, 4>,
+               Field<int, 8>, Field<int, 12>, Field<int, 16>, Field<int, 20>>
+    UskDve;
+/// KeFS
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<bool, 6>>
+    UskFlyState;
+/// KeOn, CKOn
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<bool, 2>> UskOnAir;
+/// CKeF
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<Source, 2>>
+    UskInput;
+/// CKTp
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>,
+               Field<uint8_t, 3>>
+    UskType;
+/// CKDV, CKFP
+typedef Layout<Field<uint32_t, 0>, Field<uint8_t, 4>, Field<uint8_t, 5>>
+    UskDveMask;
+/// RFlK
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>,
+               Field<uint8_t, 4>, Field<uint8_t, 5>>
+    UskRunFlyingKey;
+/// _mpl
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>> MediaPlayer;
+/// MPCE
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>,
+               Field<uint8_t, 3>>
+    MediaPlayerSource;
+/// MPSS
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>,
+               Field<uint8_t, 3>, Field<uint8_t, 4>>
+    MediaPlayerSelect;
+/// MPfe, the file name of length [3] directly follows the fields
+typedef Layout<Field<uint8_t, 0>, Field<uint16_t, 2>, Field<bool, 4>,
+               Field<uint8_t, 23>>
+    MediaPoolFrame;
+/// _MeC
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>> MixEffectConfig;
+/// _pin
+typedef Layout<String<0, 44>> ProductId;
+/// _ver
+typedef Layout<Field<uint16_t, 0>, Field<uint16_t, 2>> ProtocolVersion;
+/// StRS
+typedef Layout<Field<uint16_t, 0>> StreamStatus;
+/// StrR
+typedef Layout<Field<bool, 0>> Stream;
+/// SRsv
+typedef Layout<Field<uint32_t, 0>> SaveStartupState;
+/// _top
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>,
+               Field<uint8_t, 3>, Field<uint8_t, 4>, Field<uint8_t, 5>,
+               Field<uint8_t, 6>, Field<uint8_t, 7>, Field<uint8_t, 8>,
+               Field<uint8_t, 9>, Field<uint8_t, 10>, Field<uint8_t, 11>>
+    Topology;
+/// _top, only send by newer protocol versions
+typedef Layout<Field<uint8_t, 13>, Field<uint8_t, 18>> TopologyExtended;
+/// FTSD
+typedef Layout<Field<uint16_t, 0>, Field<uint16_t, 2>, Field<uint16_t, 6>,
+               Field<uint32_t, 8>, Field<uint16_t, 12>>
+    TransferUpload;
+/// FTCD
+typedef Layout<Field<uint16_t, 0>, Field<uint16_t, 6>, Field<uint16_t, 8>>
+    TransferContinue;
+/// FTDa, the data of length [1] directly follows the fields
+typedef Layout<Field<uint16_t, 0>, Field<uint16_t, 2>> TransferData;
+/// FTFD, the MD5 hash of the data is stored at 194
+typedef Layout<Field<uint16_t, 0>, String<2, 64>, String<66, 128>>
+    TransferDescription;
+/// FTDC
+typedef Layout<Field<uint16_t, 0>> TransferComplete;
+/// FTDE
+typedef Layout<Field<uint16_t, 0>, Field<uint8_t, 2>> TransferError;
+/// TrPs
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint16_t, 4>>
+    TransitionPosition;
+/// CTPs
+typedef Layout<Field<uint8_t, 0>, Field<uint16_t, 2>> TransitionSetPosition;
+/// TrSS
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 2>>
+    TransitionState;
+/// CTTp
+typedef Layout<Field<uint8_t, 0>, Field<uint8_t, 1>, Field<uint8_t, 3>>
+    TransitionSetState;
+
+}  // namespace layout
+
 namespace cmd {
 
-class Auto : public AtemCommand {
+class Auto : public FixedCommand<12> {
  public:
   /**
    * @brief Perform an AUTO transition on a MixEffect
    *
    * @param me[in] Which MixEffect to perform this action on
    */
-  Auto(uint8_t me) : AtemCommand("DAut", 12) { GetData<uint8_t *>()[0] = me; }
+  Auto(uint8_t me) : FixedCommand("DAut") { layout::Me::Encode(*this, me); }
 };
 
-class AuxInput : public AtemCommand {
+class AuxInput : public FixedCommand<12> {
  public:
   /**
    * @brief Change the source on a specific AUX channel
@@ -138,41 +445,40 @@ class AuxInput : public AtemCommand {
    * @param source[in] The new source for the AUX channel
    * @param channel[in] Which AUX channel to change
    */
-  AuxInput(Source source, uint8_t channel) : AtemCommand("CAuS", 12) {
-    GetData<uint8_t *>()[0] = 1;
-    GetData<uint8_t *>()[1] = channel;
-    GetData<uint16_t *>()[1] = htons(source);
+  AuxInput(Source source, uint8_t channel) : FixedCommand("CAuS") {
+    layout::AuxInput::Encode(*this, 1, channel, source);
   }
+  uint32_t GetCoalesceKey() const override { return Read<uint8_t>(1); }
 };
 
-class CaptureStill : public AtemCommand {
+class CaptureStill : public FixedCommand<8> {
  public:
-  CaptureStill() : AtemCommand("Capt", 8) {}
+  CaptureStill() : FixedCommand("Capt") {}
 };
 
-class Cut : public AtemCommand {
+class Cut : public FixedCommand<12> {
  public:
   /**
    * @brief Perform a CUT transition on a MixEffect
    *
    * @param me[in] Which MixEffect to perform the action on
    */
-  Cut(uint8_t me) : AtemCommand("DCut", 12) { GetData<uint8_t *>()[0] = me; }
+  Cut(uint8_t me) : FixedCommand("DCut") { layout::Me::Encode(*this, me); }
 };
 
-class DskAuto : public AtemCommand {
+class DskAuto : public FixedCommand<12> {
  public:
   /**
    * @brief Perform a AUTO transition on a Downstream Keyer
    *
    * @param keyer[in] Which keyer to perform the action on
    */
-  DskAuto(uint8_t keyer) : AtemCommand("DDsA", 12), keyer_(keyer) {}
+  DskAuto(uint8_t keyer) : FixedCommand("DDsA"), keyer_(keyer) {}
   void PrepairCommand(const ProtocolVersion &ver) override {
     if (ver.major <= 2 && ver.minor <= 27) {
-      GetData<uint8_t *>()[0] = this->keyer_;
+      Write<uint8_t>(0, this->keyer_);
     } else {
-      GetData<uint8_t *>()[1] = this->keyer_;
+      Write<uint8_t>(1, this->keyer_);
     }
   }
 
@@ -180,7 +486,7 @@ class DskAuto : public AtemCommand {
   uint8_t keyer_;
 };
 
-class DskOnAir : public AtemCommand {
+class DskOnAir : public FixedCommand<12> {
  public:
   /**
    * @brief Change the on air state of a Downstream Keyer
@@ -188,13 +494,12 @@ class DskOnAir : public AtemCommand {
    * @param state[in] The new stata
    * @param keyer[in] Which keyer to perform the action on
    */
-  DskOnAir(bool state, uint8_t keyer) : AtemCommand("CDsL", 12) {
-    GetData<uint8_t *>()[0] = keyer;
-    GetData<uint8_t *>()[1] = state;
+  DskOnAir(bool state, uint8_t keyer) : FixedCommand("CDsL") {
+    layout::DskFlag::Encode(*this, keyer, state);
   }
 };
 
-class DskFill : public AtemCommand {
+class DskFill : public FixedCommand<12> {
  public:
   /**
    * @brief Change the fill source on a Downstream Keyer
@@ -202,13 +507,12 @@ class DskFill : public AtemCommand {
    * @param source[in] The new source
    * @param keyer[in] Which keyer to perform the action on
    */
-  DskFill(Source source, uint8_t keyer) : AtemCommand("CDsF", 12) {
-    GetData<uint8_t *>()[0] = keyer;
-    GetData<uint16_t *>()[1] = htons(source);
+  DskFill(Source source, uint8_t keyer) : FixedCommand("CDsF") {
+    layout::DskInput::Encode(*this, keyer, source);
   }
 };
 
-class DskKey : public AtemCommand {
+class DskKey : public FixedCommand<12> {
  public:
   /**
    * @brief Change the key source on a Downstream Keye
@@ -216,13 +520,12 @@ class DskKey : public AtemCommand {
    * @param source[in] The new source
    * @param keyer[in] Which keyer to perform the action on
    */
-  DskKey(Source source, uint8_t keyer) : AtemCommand("CDsC", 12) {
-    GetData<uint8_t *>()[0] = keyer;
-    GetData<uint16_t *>()[1] = htons(source);
+  DskKey(Source source, uint8_t keyer) : FixedCommand("CDsC") {
+    layout::DskInput::Encode(*this, keyer, source);
   }
 };
 
-class DskTie : public AtemCommand {
+class DskTie : public FixedCommand<12> {
  public:
   /**
    * @brief Change the tie state of a Downstream Keyer
@@ -230,25 +533,38 @@ class DskTie : public AtemCommand {
    * @param state[in] The new state
    * @param keyer[in] Which keyer to perform the action on
    */
-  DskTie(bool state, uint8_t keyer) : AtemCommand("CDsT", 12) {
-    GetData<uint8_t *>()[0] = keyer;
-    GetData<uint8_t *>()[1] = state;
+  DskTie(bool state, uint8_t keyer) : FixedCommand("CDsT") {
+    layout::DskFlag::Encode(*this, keyer, state);
   }
 };
 
-class FadeToBlack : public AtemCommand {
+class FadeToBlack : public FixedCommand<12> {
  public:
   /**
    * @brief Perform a Fade to Black action on a specific MixEffect
    *
    * @param me[in] Which MixEffect to perform this action on
    */
-  FadeToBlack(uint8_t me) : AtemCommand("FtbA", 12) {
-    GetData<uint8_t *>()[0] = me;
+  FadeToBlack(uint8_t me) : FixedCommand("FtbA") {
+    layout::Me::Encode(*this, me);
   }
 };
 
-class MediaPlayerSource : public AtemCommand {
+class LockState : public FixedCommand<12> {
+ public:
+  /**
+   * @brief Request or release the lock on a store of the media pool, the ATEM
+   * answers with LKOB once the lock is obtained
+   *
+   * @param store[in] Which store to lock (0 for stills)
+   * @param locked[in] true to request the lock, false to release it
+   */
+  LockState(uint16_t store, bool locked) : FixedCommand("LOCK") {
+    layout::LockState::Encode(*this, store, locked);
+  }
+};
+
+class MediaPlayerSource : public FixedCommand<16> {
  public:
   /**
    * @brief Change the source of a mediaplayer
@@ -261,16 +577,13 @@ class MediaPlayerSource : public AtemCommand {
    */
   MediaPlayerSource(uint8_t mediaplayer, uint8_t mask, uint8_t type,
                     uint8_t still, uint8_t clip)
-      : AtemCommand("MPSS", 16) {
-    GetData<uint8_t *>()[0] = mask;
-    GetData<uint8_t *>()[1] = mediaplayer;
-    GetData<uint8_t *>()[2] = type;
-    GetData<uint8_t *>()[3] = still;
-    GetData<uint8_t *>()[4] = clip;
+      : FixedCommand("MPSS") {
+    layout::MediaPlayerSelect::Encode(*this, mask, mediaplayer, type, still,
+                                      clip);
   }
 };
 
-class UskDveKeyFrameProperties : public AtemCommand {
+class UskDveKeyFrameProperties : public FixedCommand<64> {
  public:
   /**
    * @brief Change the DVE properties of an Upstream Keyer.
@@ -284,23 +597,25 @@ class UskDveKeyFrameProperties : public AtemCommand {
       UskDveKeyFrame key_frame,
       std::initializer_list<std::tuple<UskDveProperty, int>> p, uint8_t keyer,
       uint8_t me)
-      : AtemCommand("CKFP", 64) {
+      : FixedCommand("CKFP") {
     uint32_t mask = 0;
 
     for (auto c : p) {
       const auto [property, value] = c;
       mask |= 1 << (uint8_t)property;
-      ((uint32_t *)this->data_)[4 + (uint8_t)property] = htonl(value);
+      Write<int>(8 + 4 * (uint8_t)property, value);
     }
 
-    GetData<uint32_t *>()[0] = htonl(mask);
-    GetData<uint8_t *>()[4] = me;
-    GetData<uint8_t *>()[5] = keyer;
-    GetData<uint8_t *>()[6] = (uint8_t)key_frame;
+    layout::UskDveMask::Encode(*this, mask, me, keyer);
+    Write<uint8_t>(6, (uint8_t)key_frame);
+  }
+  uint32_t GetCoalesceKey() const override {
+    return Read<uint32_t>(0) << 24 | Read<uint8_t>(6) << 16 |
+           Read<uint8_t>(4) << 8 | Read<uint8_t>(5);
   }
 };
 
-class UskDveRunFlyingKey : public AtemCommand {
+class UskDveRunFlyingKey : public FixedCommand<16> {
  public:
   /**
    * @brief Perform a Run to INF on a specific Upsteam Keyer
@@ -312,16 +627,13 @@ class UskDveRunFlyingKey : public AtemCommand {
    */
   UskDveRunFlyingKey(UskDveKeyFrame key_frame, uint8_t run_to_inf_i,
                      uint8_t keyer, uint8_t me)
-      : AtemCommand("RFlK", 16) {
-    GetData<uint8_t *>()[0] = 0;
-    GetData<uint8_t *>()[1] = me;
-    GetData<uint8_t *>()[2] = keyer;
-    GetData<uint8_t *>()[4] = (uint8_t)key_frame;
-    GetData<uint8_t *>()[5] = run_to_inf_i;
+      : FixedCommand("RFlK") {
+    layout::UskRunFlyingKey::Encode(*this, 0, me, keyer, (uint8_t)key_frame,
+                                    run_to_inf_i);
   }
 };
 
-class UskDveProperties : public AtemCommand {
+class UskDveProperties : public FixedCommand<72> {
  public:
   /**
    * @brief Change the current state of the DVE on a Upstream Keyer
@@ -332,22 +644,23 @@ class UskDveProperties : public AtemCommand {
    */
   UskDveProperties(std::initializer_list<std::tuple<UskDveProperty, int>> p,
                    uint8_t keyer, uint8_t me)
-      : AtemCommand("CKDV", 72) {
+      : FixedCommand("CKDV") {
     uint32_t mask = 0;
 
     for (auto c : p) {
       const auto [property, value] = c;
       mask |= 1 << (uint8_t)property;
-      ((uint32_t *)this->data_)[4 + (uint8_t)property] = htonl(value);
+      Write<int>(8 + 4 * (uint8_t)property, value);
     }
 
-    GetData<uint32_t *>()[0] = htonl(mask);
-    GetData<uint8_t *>()[4] = me;
-    GetData<uint8_t *>()[5] = keyer;
+    layout::UskDveMask::Encode(*this, mask, me, keyer);
+  }
+  uint32_t GetCoalesceKey() const override {
+    return Read<uint32_t>(0) << 16 | Read<uint8_t>(4) << 8 | Read<uint8_t>(5);
   }
 };
 
-class UskFill : public AtemCommand {
+class UskFill : public FixedCommand<12> {
  public:
   /**
    * @brief Change the fill source on a Upstream Keyer
@@ -356,14 +669,12 @@ class UskFill : public AtemCommand {
    * @param keyer[in] Which Upstream Keyer to perform this action on
    * @param me[in] Which MixEffect to perform this action on
    */
-  UskFill(Source source, uint8_t keyer, uint8_t me) : AtemCommand("CKeF", 12) {
-    GetData<uint8_t *>()[0] = me;
-    GetData<uint8_t *>()[1] = keyer;
-    GetData<uint16_t *>()[1] = htons(source);
+  UskFill(Source source, uint8_t keyer, uint8_t me) : FixedCommand("CKeF") {
+    layout::UskInput::Encode(*this, me, keyer, source);
   }
 };
 
-class UskType : public AtemCommand {
+class UskType : public FixedCommand<16> {
  public:
   /**
    * @brief Change the type of the Upstream Keyer
@@ -372,15 +683,12 @@ class UskType : public AtemCommand {
    * @param keyer[in] Which Upstream Keyer to perform this action on
    * @param me[in] Which MixEffect to perform this action on
    */
-  UskType(uint8_t type, uint8_t keyer, uint8_t me) : AtemCommand("CKTp", 16) {
-    GetData<uint8_t *>()[0] = 1;  // Mask
-    GetData<uint8_t *>()[1] = me;
-    GetData<uint8_t *>()[2] = keyer;
-    GetData<uint8_t *>()[3] = type;
+  UskType(uint8_t type, uint8_t keyer, uint8_t me) : FixedCommand("CKTp") {
+    layout::UskType::Encode(*this, 1, me, keyer, type);
   }
 };
 
-class UskOnAir : public AtemCommand {
+class UskOnAir : public FixedCommand<12> {
  public:
   /**
    * @brief Change the On air state of a Upstream Keyer
@@ -389,14 +697,12 @@ class UskOnAir : public AtemCommand {
    * @param keyer[in] Which Upstream Keyer to perform this action on
    * @param me[in] Which MixEffect to perform this action on
    */
-  UskOnAir(bool enabled, uint8_t key, uint8_t me) : AtemCommand("CKOn", 12) {
-    GetData<uint8_t *>()[0] = me;
-    GetData<uint8_t *>()[1] = key;
-    GetData<uint8_t *>()[2] = enabled;
+  UskOnAir(bool enabled, uint8_t key, uint8_t me) : FixedCommand("CKOn") {
+    layout::UskOnAir::Encode(*this, me, key, enabled);
   }
 };
 
-class PreviewInput : public AtemCommand {
+class PreviewInput : public FixedCommand<12> {
  public:
   /**
    * @brief Change the preview source on a MixEffect
@@ -404,13 +710,13 @@ class PreviewInput : public AtemCommand {
    * @param source[in] The new preview source
    * @param me[in] Which MixEffect to perform this action on
    */
-  PreviewInput(Source source, uint8_t me) : AtemCommand("CPvI", 12) {
-    GetData<uint8_t *>()[0] = me;
-    GetData<uint16_t *>()[1] = htons(source);
+  PreviewInput(Source source, uint8_t me) : FixedCommand("CPvI") {
+    layout::MeSource::Encode(*this, me, source);
   }
+  uint32_t GetCoalesceKey() const override { return Read<uint8_t>(0); }
 };
 
-class ProgramInput : public AtemCommand {
+class ProgramInput : public FixedCommand<12> {
  public:
   /**
    * @brief Change the program source on a MixEffect
@@ -418,33 +724,106 @@ class ProgramInput : public AtemCommand {
    * @param source[in] The new program source
    * @param me[in] Which MixEffect to perform this action on
    */
-  ProgramInput(Source source, uint8_t me) : AtemCommand("CPgI", 12) {
-    GetData<uint8_t *>()[0] = me;
-    GetData<uint16_t *>()[1] = htons(source);
+  ProgramInput(Source source, uint8_t me) : FixedCommand("CPgI") {
+    layout::MeSource::Encode(*this, me, source);
   }
+  uint32_t GetCoalesceKey() const override { return Read<uint8_t>(0); }
 };
 
-class SaveStartupState : public AtemCommand {
+class SaveStartupState : public FixedCommand<12> {
  public:
   /**
    * @brief Save the current state of the ATEM as its startup state
    */
-  SaveStartupState() : AtemCommand("SRsv", 12) { GetData<uint32_t *>()[0] = 0; }
+  SaveStartupState() : FixedCommand("SRsv") {
+    layout::SaveStartupState::Encode(*this, 0);
+  }
 };
 
-class Stream : public AtemCommand {
+class Stream : public FixedCommand<12> {
  public:
   /**
    * @brief Start or stop streaming.
    *
    * @param state[in] The new state
    */
-  Stream(bool state) : AtemCommand("StrR", 12) {
-    GetData<uint8_t *>()[0] = state;
+  Stream(bool state) : FixedCommand("StrR") {
+    layout::Stream::Encode(*this, state);
+  }
+};
+
+class TransferData : public AtemCommand {
+ public:
+  /// The offset of the data inside the command, including the header
+  static constexpr uint16_t kHeader = layout::TransferData::kLength;
+
+  /**
+   * @brief Send a chunk of data during a transfer, the data must be written
+   * to GetData<uint8_t *>() + 4 after creating the command
+   *
+   * @param id[in] The id of the transfer
+   * @param length[in] The length of the data
+   */
+  TransferData(uint16_t id, uint16_t length)
+      : AtemCommand("FTDa", kHeader + length) {
+    layout::TransferData::Encode(*this, id, length);
+  }
+  /**
+   * @brief Write the header of a chunk directly into a packet, so the data
+   * can be read into the packet without a copy
+   *
+   * @param buffer[out] Where the command starts, the data follows at kHeader
+   * @param id[in] The id of the transfer
+   * @param length[in] The length of the data
+   */
+  static void WriteHeader(void *buffer, uint16_t id, uint16_t length) {
+    const uint16_t header[2] = {htons(kHeader + length), 0};
+    memcpy(buffer, header, sizeof(header));
+    memcpy((uint8_t *)buffer + 4, "FTDa", 4);
+
+    AtemCommand command(buffer);
+    layout::TransferData::Encode(command, id, length);
+  }
+};
+
+class TransferDescription : public FixedCommand<220> {
+ public:
+  /**
+   * @brief Describe the file that has been uploaded
+   *
+   * @param id[in] The id of the transfer
+   * @param name[in] The name of the file
+   * @param description[in] The description of the file
+   * @param hash[in] The MD5 hash of the data (16 bytes)
+   */
+  TransferDescription(uint16_t id, const char *name, const char *description,
+                      const uint8_t *hash)
+      : FixedCommand("FTFD") {
+    layout::TransferDescription::Encode(*this, id, name, description);
+    memcpy(this->GetData<uint8_t *>() + 194, hash, 16);
+  }
+};
+
+class TransferUpload : public FixedCommand<24> {
+ public:
+  /**
+   * @brief Start uploading data to a store of the media pool, the ATEM asks
+   * for the data with FTCD
+   *
+   * @param id[in] The id of the transfer, chosen by the client
+   * @param store[in] Which store to upload to (0 for stills)
+   * @param index[in] The index inside the store
+   * @param size[in] The size of the data in bytes
+   * @param mode[in] The kind of transfer (1 to write)
+   */
+  TransferUpload(uint16_t id, uint16_t store, uint16_t index, uint32_t size,
+                 uint16_t mode)
+      : FixedCommand("FTSD") {
+    layout::TransferUpload::Encode(*this, id, store, index, size, mode);
   }
 };
 
-class TransitionPosition : public AtemCommand {
+class TransitionPosition : public FixedCommand<12> {
  public:
   /**
    * @brief Change the AUTO transition position
@@ -452,13 +831,13 @@ class TransitionPosition : public AtemCommand {
    * @param position[in] The new position (between 0 and 10000)
    * @param me[in] Which MixEffect to perform this action on
    */
-  TransitionPosition(uint16_t position, uint8_t me) : AtemCommand("CTPs", 12) {
-    GetData<uint8_t *>()[0] = me;
-    GetData<uint16_t *>()[1] = htons(position);
+  TransitionPosition(uint16_t position, uint8_t me) : FixedCommand("CTPs") {
+    layout::TransitionSetPosition::Encode(*this, me, position);
   }
+  uint32_t GetCoalesceKey() const override { return Read<uint8_t>(0); }
 };
 
-class TransitionState : public AtemCommand {
+class TransitionState : public FixedCommand<12> {
  public:
   /**
    * @brief The transition state of the MixEffect
@@ -466,10 +845,8 @@ class TransitionState : public AtemCommand {
    * @param next[in] A bitmask of the Keyers active
    * @param me[in] Which MixEffect to perform this action on
    */
-  TransitionState(uint8_t next, uint8_t me) : AtemCommand("CTTp", 12) {
-    GetData<uint8_t *>()[0] = 0x2;  // Mask
-    GetData<uint8_t *>()[1] = me;
-    GetData<uint8_t *>()[3] = next;
+  TransitionState(uint8_t next, uint8_t me) : FixedCommand("CTTp") {
+    layout::TransitionSetState::Encode(*this, 0x2, me, next);  // Mask
   }
 };
 
@@ -0,0 +1,119 @@
+/**
+ * @file atem_journal.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief A ring of the fields of the state that have been changed by the
+ * parser.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+#include <freertos/FreeRTOS.h>
+#include <sdkconfig.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace atem {
+
+/**
+ * @brief The field of the state that has changed, the comment lists what the
+ * index and sub index of the change are.
+ */
+enum class ChangeField : uint8_t {
+  kProtocolVersion,     // _ver
+  kProductId,           // _pin
+  kTopology,            // _top, _MeC (index: ME)
+  kMediaPlayer,         // _mpl
+  kAux,                 // AuxS (index: channel)
+  kDskSource,           // DskB (index: keyer)
+  kDskProperties,       // DskP (index: keyer)
+  kDskState,            // DskS (index: keyer)
+  kFadeToBlack,         // FtbS (index: ME)
+  kInputProperty,       // InPr (index: source)
+  kUskState,            // KeBP (index: ME, sub: keyer)
+  kUskDve,              // KeDV (index: ME, sub: keyer)
+  kUskAtKeyFrame,       // KeFS (index: ME, sub: keyer)
+  kUskOnAir,            // KeOn (index: ME, sub: keyer)
+  kMediaPlayerSource,   // MPCE (index: media player)
+  kMediaPoolFile,       // MPfe (index: still)
+  kProgram,             // PrgI (index: ME)
+  kPreview,             // PrvI (index: ME)
+  kStream,              // StRS
+  kTransitionPosition,  // TrPs (index: ME)
+  kTransitionState,     // TrSS (index: ME)
+};
+
+/**
+ * @brief A single field that has been changed
+ */
+struct Change {
+  /// The id of the packet that changed the field
+  uint16_t packet_id;
+  ChangeField field;
+  uint8_t sub;
+  uint16_t index;
+};
+
+/**
+ * @brief Keeps the last CONFIG_ATEM_CHANGE_JOURNAL_SIZE changes made by the
+ * parser, so a task can redraw only what has changed since it last looked.
+ *
+ * Every change gets a sequence number that never wraps (unlike packet ids,
+ * which also restart on every connection). A reader keeps the sequence it has
+ * read up to, and is told when changes it hasn't read have been overwritten.
+ *
+ * @code
+ *  uint32_t cursor = 0;
+ *  atem::Change changes[16];
+ *  bool behind;
+ *  size_t n = atem_connection->GetChangesSince(cursor, changes, 16, behind);
+ *  if (behind) RedrawAll();
+ *  for (size_t i = 0; i < n; i++) Redraw(changes[i]);
+ * @endcode
+ */
+class ChangeJournal {
+ public:
+  /**
+   * @brief Add a change, only the parser task may call this
+   *
+   * @param change[in] The field that has changed
+   */
+  void Add(const Change& change);
+  /**
+   * @brief Remove all changes (e.g. when the initial state is swapped in),
+   * every reader will be behind.
+   */
+  void Clear();
+  /**
+   * @brief Get the changes after cursor, oldest first. Call this again when
+   * length changes are returned, there may be more. The changes are copied
+   * with interrupts disabled, so keep length small (e.g. 16).
+   *
+   * @param cursor[in,out] The sequence up to which the changes have been
+   * read, 0 for a new reader. It's moved past the returned changes.
+   * @param changes[out] Where to store the changes
+   * @param length[in] The maximum amount of changes to return
+   * @param behind[out] Changes after cursor have been overwritten or cleared,
+   * the reader has to read the full state
+   * @return size_t The amount of changes stored in changes
+   */
+  size_t GetChangesSince(uint32_t& cursor, Change* changes, size_t length,
+                         bool& behind);
+  /**
+   * @brief Get the sequence of the next change, a cursor with this value has
+   * read all changes.
+   *
+   * @return uint32_t
+   */
+  uint32_t GetCursor() const { return this->head_; }
+
+ protected:
+  Change changes_[CONFIG_ATEM_CHANGE_JOURNAL_SIZE];
+  // The sequence of the next change, it's stored at changes_[head_ % size]
+  uint32_t head_{1};
+  // The first sequence after the last Clear, the sequence before it is never
+  // used so every cursor is behind it
+  uint32_t start_{1};
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+}  // namespace atem
@@ -7,22 +7,127 @@
  * @copyright Copyright (c) 2023 - Wouter (wjtje)
  */
 #pragma once
+#include <freertos/FreeRTOS.h>
+#include <sdkconfig.h>
+
 #include <cstring>
 
 #include "atem_command.h"
 
 namespace atem {
 
+/**
+ * @brief A preallocated pool of buffers for packets, acquiring and releasing a
+ * buffer is O(1) and never uses the heap. Small buffers are used for ACKs and
+ * commands, large buffers fit every packet (e.g. merged packets).
+ */
+class PacketPool {
+ public:
+  /// The size of a large buffer, a packet is never larger than this
+  static constexpr size_t kLargeSize = (CONFIG_PACKET_BUFFER_SIZE + 3) & ~3;
+
+  /**
+   * @brief Get a buffer of at least length bytes, the buffer is taken from the
+   * pool when possible and allocated on the heap otherwise.
+   *
+   * @param length[in] The length of the buffer
+   * @return void* nullptr when out of memory
+   */
+  static void* Acquire(uint16_t length);
+  /**
+   * @brief Give a buffer back to the pool, or free it when it was allocated on
+   * the heap.
+   *
+   * @param data[in] A buffer returned by Acquire
+   */
+  static void Release(void* data);
+  /**
+   * @brief Get the amount of times a buffer had to be allocated on the heap
+   * because all buffers of the pool were in use.
+   *
+   * @return uint32_t
+   */
+  static uint32_t GetExhaustedCount() { return exhausted_; }
+  /**
+   * @brief Get the amount of buffers in the pool that are not in use.
+   *
+   * @return size_t
+   */
+  static size_t GetFree() { return small_free_ + large_free_; }
+
+ protected:
+  // The headers are accessed as uint16_t and uint32_t, so every buffer starts
+  // on a 4 byte boundary
+  static constexpr size_t kSmallSize =
+      (CONFIG_ATEM_PACKET_POOL_BUFFER_SIZE + 3) & ~3;
+  static constexpr size_t kSmallCount = CONFIG_ATEM_PACKET_POOL_SIZE;
+  static constexpr size_t kLargeCount = CONFIG_ATEM_PACKET_POOL_LARGE_COUNT;
+  // All small buffers followed by all large buffers
+  alignas(4) static uint8_t
+      buffers_[kSmallCount * kSmallSize + kLargeCount * kLargeSize];
+  // Stacks of the indices of the buffers that are not in use, the stack of
+  // the large buffers starts at kSmallCount
+  static uint8_t free_[kSmallCount + kLargeCount];
+  static size_t small_free_;
+  static size_t large_free_;
+  static uint32_t exhausted_;
+  static portMUX_TYPE mux_;
+};
+
 /**
  * @brief This class is a wrapper for a raw buffer, that can decode ATEM data.
  *
  */
 class AtemPacket {
  public:
+  AtemPacket() : has_alloc_(false) {}
   AtemPacket(void* data) : has_alloc_(false), data_(data) {}
+  /**
+   * @brief Create a new packet, the buffer is taken from the PacketPool.
+   *
+   * @param flags[in] The flags of the packet
+   * @param session[in] The session id
+   * @param length[in] The length of the packet including the header
+   */
   AtemPacket(uint8_t flags, uint16_t session, uint16_t length);
+  AtemPacket(const AtemPacket&) = delete;
+  AtemPacket(AtemPacket&& other)
+      : has_alloc_(other.has_alloc_), data_(other.data_) {
+    other.has_alloc_ = false;
+  }
+  AtemPacket& operator=(const AtemPacket&) = delete;
+  AtemPacket& operator=(AtemPacket&& other) {
+    if (this == &other) return *this;
+    if (this->has_alloc_) PacketPool::Release(this->data_);
+    this->has_alloc_ = other.has_alloc_;
+    this->data_ = other.data_;
+    other.has_alloc_ = false;
+    return *this;
+  }
   ~AtemPacket();
 
+  /**
+   * @brief Give up the ownership of the buffer, it must be taken over by
+   * another packet using Adopt.
+   *
+   * @return void* The buffer
+   */
+  void* Detach() {
+    this->has_alloc_ = false;
+    return this->data_;
+  }
+  /**
+   * @brief Create a packet that owns a buffer returned by Detach
+   *
+   * @param data[in] The buffer
+   * @return AtemPacket
+   */
+  static AtemPacket Adopt(void* data) {
+    AtemPacket packet(data);
+    packet.has_alloc_ = data != nullptr;
+    return packet;
+  }
+
   /**
    * @brief Get access to the raw data buffer, advance use only
    *
@@ -75,6 +180,9 @@ class AtemPacket {
     const uint8_t byte = ((uint8_t*)this->data_)[0];
     ((uint8_t*)this->data_)[0] = flags << 3 | (byte & 0x7);
   }
+  void SetSessionId(uint16_t session) {
+    ((uint16_t*)this->data_)[1] = htons(session);
+  }
   void SetAckId(int16_t id) { ((int16_t*)this->data_)[2] = htons(id); }
   void SetResendId(int16_t id) { ((int16_t*)this->data_)[3] = htons(id); }
   void SetUnknown(int16_t id) { ((int16_t*)this->data_)[4] = htons(id); }
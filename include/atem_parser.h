@@ -0,0 +1,140 @@
+/**
+ * @file atem_parser.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief Provides the state of the switcher and the handlers that parse the
+ * commands send by an ATEM into that state.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "atem_command.h"
+#include "atem_journal.h"
+#include "atem_state.h"
+#include "atem_types.h"
+#include "input_table.h"
+#include "string_arena.h"
+
+namespace atem {
+
+/**
+ * @brief A copy of the most used state of an ATEM (e.g. for tally), without
+ * any pointers so it can be read without locking the state.
+ */
+struct StateSnapshot {
+  static constexpr uint8_t kMaxMe = 4;
+  static constexpr uint8_t kMaxDsk = 4;
+  static constexpr uint8_t kMaxAux = 24;
+  static constexpr uint8_t kMaxMediaPlayers = 4;
+
+  /**
+   * @brief A value with a flag that tells if the ATEM has send it
+   */
+  template <typename T>
+  struct Value {
+    bool valid;
+    T value;
+  };
+
+  struct Me {
+    Value<Source> program;
+    Value<Source> preview;
+    Value<uint16_t> usk_on_air;
+    Value<TransitionState> transition_state;
+    Value<TransitionPosition> transition_position;
+    Value<FadeToBlack> ftb;
+  };
+  struct Dsk {
+    Value<DskState> state;
+    Value<DskSource> source;
+  };
+
+  /// The initial state has been received
+  bool connected;
+  /// The id of the last packet that has been parsed
+  uint16_t packet_id;
+  /// The model of the ATEM, see Atem::GetProductId
+  char product_id[45];
+
+  Value<ProtocolVersion> version;
+  Value<Topology> topology;
+  Value<MediaPlayer> media_player;
+  Value<StreamState> stream;
+
+  /// The amount of entries below that are used
+  uint8_t me_count, dsk_count, aux_count, media_player_count;
+
+  Me me[kMaxMe];
+  Dsk dsk[kMaxDsk];
+  Value<Source> aux[kMaxAux];
+  Value<MediaPlayerSource> media_player_source[kMaxMediaPlayers];
+};
+
+/**
+ * @brief All the state of an ATEM that is kept by this library.
+ */
+struct SwitcherState {
+  InputTable input_properties;
+  AtemState<Topology> topology;
+  AtemState<ProtocolVersion> version;
+  AtemState<MediaPlayer> media_player;
+  char product_id[45] = {0};
+  std::vector<MixEffect> mix_effect;
+  std::vector<Dsk> dsk;
+  std::vector<AtemState<Source>> aux_out;
+  std::vector<AtemState<MediaPlayerSource>> media_player_source;
+  StringArena media_player_file;
+  AtemState<StreamState> stream{StreamState::IDLE};
+
+  /**
+   * @brief Clear all the state and free the memory used by it.
+   */
+  void Reset();
+  /**
+   * @brief Copy the state into a snapshot, entries that don't fit in the
+   * snapshot are left out.
+   *
+   * @param snapshot[out] The snapshot, packet_id isn't set
+   */
+  void TakeSnapshot(StateSnapshot& snapshot) const;
+};
+
+namespace parser {
+
+/**
+ * @brief The context a command is parsed in.
+ */
+struct Context {
+  /// The state the command is parsed into
+  SwitcherState& state;
+  /// The packet id of the packet that contains the command
+  int16_t id;
+  /// Bitmask of all ATEM_EVENT_* that have changed
+  uint32_t event{0};
+  /// Per ATEM_EVENT_* a bitmask of the indices that have changed, see
+  /// AtemEventData
+  uint64_t dirty[32]{};
+  /// The journal the changed fields are added to, nullptr to skip
+  ChangeJournal* journal{nullptr};
+};
+
+/**
+ * @brief A function that parses a single command into the state.
+ */
+typedef void (*Handler)(Context& ctx, AtemCommand& command);
+
+/**
+ * @brief Find the handler for a command
+ *
+ * @param cmd[in] The command, created using ATEM_CMD
+ * @return Handler The handler, nullptr when this command isn't supported
+ */
+Handler FindHandler(uint32_t cmd);
+
+}  // namespace parser
+
+}  // namespace atem
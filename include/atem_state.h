@@ -24,6 +24,8 @@ class AtemState {
   AtemState(const SequenceCheck& sequence, const T& state)
       : last_change_id_(sequence.GetLastId()), state_(state) {}
 
+  AtemState(int16_t id, const T& state) : last_change_id_(id), state_(state) {}
+
   AtemState(const T& state = T()) : last_change_id_(INT16_MIN), state_(state) {}
 
   ~AtemState() {}
@@ -56,20 +58,30 @@ class AtemState {
    * @param state[in] The new state
    * @return bool This returns true when the state has been changed.
    */
-  bool Set(const SequenceCheck& sequence, const T& state) {
+  bool Set(int16_t id, const T& state) {
     // Check if the current data is newer
-    if (sequence.IsNewer(this->last_change_id_)) {
+    if (id < this->last_change_id_) {
 #if CONFIG_COMPILER_CXX_RTTI
       ESP_LOGD("AtemState", "%s: %u > %u", typeid(T).name(),
-               this->last_change_id_, sequence.GetLastId());
+               this->last_change_id_, id);
 #endif
       return false;
     }
 
-    this->last_change_id_ = sequence.GetLastId();
+    this->last_change_id_ = id;
     this->state_ = state;
     return true;
   }
+  /**
+   * @brief Set the state to a new value, using the last id of the sequence.
+   *
+   * @param sequence[in] The sequence of the received packets
+   * @param state[in] The new state
+   * @return bool This returns true when the state has been changed.
+   */
+  bool Set(const SequenceCheck& sequence, const T& state) {
+    return this->Set(sequence.GetLastId(), state);
+  }
   /**
    * @brief This will "reset" the last change id. This can be executed when a
    * rollover has happened.
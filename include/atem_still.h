@@ -0,0 +1,196 @@
+/**
+ * @file atem_still.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief Encodes images into the format of the stills in the media pool of an
+ * ATEM.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace atem {
+
+/**
+ * @brief Converts an image line by line into RLE compressed YUVA. Only a
+ * single line is kept in memory, so the still can be encoded while it's
+ * uploaded.
+ *
+ * Every 2 pixels are stored as 2 big endian words of 32 bits (10 bits alpha,
+ * 10 bits Cb or Cr and 10 bits Y, BT.709). Runs of 3 or more of the same 8
+ * bytes are replaced by kRleHeader, the length of the run (64 bits, big
+ * endian) and the 8 bytes.
+ *
+ * @code
+ *  atem::StillEncoder encoder(1920, 1080, atem::StillEncoder::Format::kRGBA,
+ *                             read_line, file);
+ *  if (!encoder.IsValid()) return;
+ *  upload.UploadStill(0, encoder.GetDecodedSize(), "Logo",
+ *                     atem::StillEncoder::Read, atem::StillEncoder::Rewind,
+ *                     &encoder);
+ * @endcode
+ */
+class StillEncoder {
+ public:
+  enum class Format : uint8_t {
+    // 8 bits per channel, R G B A
+    kRGBA,
+    // Already in the format of the ATEM, only RLE compressed
+    kYUVA,
+  };
+
+  /**
+   * @brief Reads a line of the image
+   *
+   * @param line[out] Where to store the line (width * 4 bytes)
+   * @param y[in] The index of the line, lines are read again after Rewind
+   * @param arg[in] The argument given to the constructor
+   * @return false When the line couldn't be read, this ends the still
+   */
+  typedef bool (*LineReader)(uint8_t* line, uint16_t y, void* arg);
+
+  /// Marks a run of the same 8 bytes
+  static constexpr uint64_t kRleHeader = 0xFEFEFEFEFEFEFEFE;
+
+  /**
+   * @brief Create an encoder for a single still
+   *
+   * @param width[in] The width of the still, must be even (see IsValid)
+   * @param height[in] The height of the still
+   * @param format[in] The format of the lines
+   * @param reader[in] The function that reads the lines
+   * @param arg[in] The argument passed to the reader
+   */
+  StillEncoder(uint16_t width, uint16_t height, Format format,
+               LineReader reader, void* arg);
+  ~StillEncoder();
+  StillEncoder(const StillEncoder&) = delete;
+  StillEncoder& operator=(const StillEncoder&) = delete;
+
+  /**
+   * @brief Returns weather or not the still can be encoded, false when the
+   * width is odd or the buffers couldn't be allocated. Nothing is read from
+   * an encoder that isn't valid.
+   *
+   * @return bool
+   */
+  bool IsValid() const {
+    return this->width_ % 2 == 0 && this->line_ != nullptr &&
+           this->out_ != nullptr;
+  }
+
+  /**
+   * @brief Get the size of the still without compression
+   *
+   * @return uint32_t
+   */
+  uint32_t GetDecodedSize() const {
+    return (uint32_t)this->width_ * this->height_ * 4;
+  }
+  /**
+   * @brief Get the amount of bytes that have been encoded so far
+   *
+   * @return size_t
+   */
+  size_t GetEncodedSize() const { return this->encoded_; }
+
+  /**
+   * @brief Read the next part of the encoded still, lines are encoded when
+   * needed.
+   *
+   * @param buffer[out] Where to store the encoded data
+   * @param length[in] The amount of bytes to read
+   * @return size_t The amount of bytes read, less than length at the end
+   */
+  size_t Read(void* buffer, size_t length);
+  /**
+   * @brief Read function that can be used as MediaUpload::Reader
+   *
+   * @param arg[in] The StillEncoder
+   */
+  static size_t Read(void* buffer, size_t length, void* arg) {
+    return ((StillEncoder*)arg)->Read(buffer, length);
+  }
+  /**
+   * @brief Start encoding from the first line again
+   */
+  void Rewind();
+  /**
+   * @brief Rewind function that can be used as MediaUpload::Rewind
+   *
+   * @param arg[in] The StillEncoder
+   * @return bool false when the encoder isn't valid
+   */
+  static bool Rewind(void* arg) {
+    ((StillEncoder*)arg)->Rewind();
+    return ((StillEncoder*)arg)->IsValid();
+  }
+
+  /**
+   * @brief Convert a line of RGBA pixels into the YUVA format of the ATEM
+   *
+   * @param rgba[in] The pixels (width * 4 bytes)
+   * @param yuva[out] The converted pixels (width * 4 bytes)
+   * @param width[in] The amount of pixels, must be even
+   */
+  static void ConvertLine(const uint8_t* rgba, uint8_t* yuva, uint16_t width);
+  /**
+   * @brief Compress a line in the YUVA format, the last run is kept until the
+   * next line or Flush.
+   *
+   * @param yuva[in] The pixels (width * 4 bytes)
+   * @param out[out] At least GetMaxLineLength bytes
+   * @return size_t The amount of bytes written to out
+   */
+  size_t CompressLine(const uint8_t* yuva, uint8_t* out);
+  /**
+   * @brief Write the last run
+   *
+   * @param out[out] At least 24 bytes
+   * @return size_t The amount of bytes written to out
+   */
+  size_t Flush(uint8_t* out);
+  /**
+   * @brief Get the maximum amount of bytes CompressLine writes
+   *
+   * @return size_t
+   */
+  size_t GetMaxLineLength() const { return this->width_ * 4 + 24; }
+
+ protected:
+  uint16_t width_;
+  uint16_t height_;
+  Format format_;
+  LineReader reader_;
+  void* arg_;
+
+  // The line that's being read and the encoded data of it
+  uint8_t* line_;
+  uint8_t* out_;
+  size_t out_length_{0};
+  size_t out_pos_{0};
+  uint16_t y_{0};
+  bool done_{false};
+  size_t encoded_{0};
+
+  // The run that hasn't been written yet
+  uint64_t run_value_{0};
+  uint64_t run_length_{0};
+
+  /**
+   * @brief Write a run of the same 8 bytes
+   *
+   * @param out[out] At least 24 bytes
+   * @return size_t The amount of bytes written
+   */
+  size_t WriteRun_(uint8_t* out);
+  /**
+   * @brief Read and encode the next line into out_
+   *
+   * @return false When there are no lines left
+   */
+  bool EncodeNextLine_();
+};
+
+}  // namespace atem
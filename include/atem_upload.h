@@ -0,0 +1,171 @@
+/**
+ * @file atem_upload.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief Uploads stills to the media pool of an ATEM using the data transfer
+ * commands.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <mbedtls/md5.h>
+#include <sdkconfig.h>
+#include <stdint.h>
+
+#include "atem.h"
+
+namespace atem {
+
+#if CONFIG_ATEM_STORE_SEND
+/**
+ * @brief Uploads data to the media pool. The data is read in chunks while
+ * sending, so the whole still never has to be in memory.
+ *
+ * The transfer goes as follows:
+ *  1. Read all data to get the MD5 hash and the size, then rewind it
+ *  2. LOCK the store, the ATEM answers with LKOB
+ *  3. FTSD to start the transfer
+ *  4. The ATEM sends FTCD with the amount of FTDa chunks it accepts, the
+ *     first one is answered with FTFD (the name and hash) before the chunks
+ *  5. Repeat 4 until all data is send
+ *  6. The ATEM sends FTDC (or FTDE on error), the store is unlocked
+ *
+ * @code
+ *  atem::MediaUpload upload(atem_connection);
+ *  upload.UploadStill(0, size, "Lower third", read_file, rewind_file, file);
+ * @endcode
+ */
+class MediaUpload {
+ public:
+  /**
+   * @brief Reads the next part of the data, the data must already be encoded
+   * in the format of the ATEM (RLE compressed YUVA, see StillEncoder).
+   *
+   * @param buffer[out] Where to store the data
+   * @param length[in] The amount of bytes to read
+   * @param arg[in] The argument given to UploadStill
+   * @return size_t The amount of bytes read, less than length at the end of
+   * the data
+   */
+  typedef size_t (*Reader)(void* buffer, size_t length, void* arg);
+  /**
+   * @brief Go back to the start of the data, the data is read twice: once to
+   * calculate the hash and once while sending. The same data must be read
+   * both times.
+   *
+   * @param arg[in] The argument given to UploadStill
+   * @return bool false when the data can't be read again
+   */
+  typedef bool (*Rewind)(void* arg);
+
+  /**
+   * @brief Statistics of the last upload
+   */
+  struct Stats {
+    // Bytes send
+    size_t bytes;
+    // FTDa commands send
+    uint32_t chunks;
+    // Time from the LOCK until the ATEM finished the transfer, in us
+    uint32_t duration;
+    // Bytes per second
+    uint32_t throughput;
+  };
+
+  MediaUpload(Atem* atem);
+  ~MediaUpload();
+
+  /**
+   * @brief Upload a still to the media pool, this blocks until the ATEM has
+   * received all data.
+   *
+   * @param index[in] The index of the still in the media pool
+   * @param size[in] The size of the still without compression in bytes
+   * (width * height * 4)
+   * @param name[in] The name of the still
+   * @param reader[in] The function that reads the data
+   * @param rewind[in] The function that goes back to the start of the data
+   * @param arg[in] The argument passed to the reader and rewind
+   * @param description[in] The description of the still
+   *
+   * @return ESP_ERR_TIMEOUT when the ATEM didn't respond, ESP_FAIL when the
+   * ATEM rejected the transfer and ESP_ERR_INVALID_SIZE when there is no data
+   * or the data changed after rewinding
+   */
+  esp_err_t UploadStill(uint16_t index, size_t size, const char* name,
+                        Reader reader, Rewind rewind, void* arg,
+                        const char* description = "");
+  /**
+   * @brief Get the statistics of the last upload
+   *
+   * @return Stats
+   */
+  Stats GetStats() const { return this->stats_; }
+
+ protected:
+  // Time to wait for every answer of the ATEM
+  static constexpr TickType_t kTimeout = pdMS_TO_TICKS(5000);
+  // Store of the stills in the media pool
+  static constexpr uint16_t kStillStore = 0;
+
+  enum class EventType : uint8_t {
+    kLockObtained,  // LKOB
+    kContinue,      // FTCD
+    kComplete,      // FTDC
+    kError,         // FTDE
+  };
+  // A command received from the ATEM, copied out of the parser task
+  struct Event {
+    EventType type;
+    uint16_t id;
+    uint16_t chunk_size;
+    uint16_t chunk_count;
+  };
+
+  Atem* atem_;
+  QueueHandle_t events_;
+  // Every packet with chunks holds a token until its callback is called
+  SemaphoreHandle_t window_;
+  esp_err_t chunk_result_{ESP_OK};
+  uint16_t transfer_id_{0};
+  Stats stats_{0, 0, 0, 0};
+
+  /**
+   * @brief Wait for a command about the current transfer
+   *
+   * @param event[out] The received command
+   * @return esp_err_t ESP_ERR_TIMEOUT after kTimeout
+   */
+  esp_err_t WaitForEvent_(Event& event);
+  /**
+   * @brief Read all data to calculate the hash, then rewind it
+   *
+   * @param reader[in] The function that reads the data
+   * @param rewind[in] The function that goes back to the start of the data
+   * @param arg[in] The argument passed to the reader and rewind
+   * @param hash[out] The MD5 hash of the data (16 bytes)
+   * @param length[out] The length of the data
+   * @return esp_err_t
+   */
+  esp_err_t Hash_(Reader reader, Rewind rewind, void* arg, uint8_t* hash,
+                  size_t& length);
+  /**
+   * @brief Send the chunks the ATEM asked for with FTCD
+   *
+   * @param event[in] The FTCD command
+   * @param reader[in] The function that reads the data
+   * @param arg[in] The argument passed to the reader
+   * @param remaining[in,out] The amount of bytes that haven't been send
+   * @return esp_err_t
+   */
+  esp_err_t SendChunks_(const Event& event, Reader reader, void* arg,
+                        size_t& remaining);
+
+  static void CommandHook_(AtemCommand& command, void* arg);
+  static void ChunkAcked_(esp_err_t result, uint32_t latency, void* arg);
+};
+#endif
+
+}  // namespace atem
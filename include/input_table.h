@@ -0,0 +1,215 @@
+/**
+ * @file input_table.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief A flat table of the properties of all inputs, indexed by source
+ * without searching.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "atem_state.h"
+#include "atem_types.h"
+
+namespace atem {
+
+/**
+ * @brief Maps the sparse Source values onto a dense index. The sources are
+ * grouped in ranges (inputs, colors, media players, ...), a range may contain
+ * values that aren't used.
+ */
+class SourceIndex {
+ public:
+  /// Returned for a source outside of all ranges
+  static constexpr uint16_t kInvalid = UINT16_MAX;
+
+  /**
+   * @brief Get the dense index of a source
+   *
+   * @param source[in]
+   * @return uint16_t kInvalid when the source isn't known
+   */
+  static constexpr uint16_t FromSource(Source source) {
+    uint16_t offset = 0;
+    for (const Range& range : kRanges) {
+      if (source >= range.first && source <= range.last)
+        return offset + (source - range.first);
+      offset += range.last - range.first + 1;
+    }
+    return kInvalid;
+  }
+  /**
+   * @brief Get the source of a dense index
+   *
+   * @param index[in] An index smaller than kCount
+   * @return Source UNDEFINED when the index is out of range
+   */
+  static constexpr Source ToSource(uint16_t index) {
+    for (const Range& range : kRanges) {
+      const uint16_t length = range.last - range.first + 1;
+      if (index < length) return Source(range.first + index);
+      index -= length;
+    }
+    return UNDEFINED;
+  }
+
+ protected:
+  struct Range {
+    uint16_t first;
+    uint16_t last;
+  };
+  // Sorted, so the dense index follows the order of the sources
+  static constexpr Range kRanges[] = {
+      {BLACK, INPUT_40},
+      {COLOR_BARS, COLOR_BARS},
+      {COLOR_GEN_1, COLOR_GEN_2},
+      {MEDIAPLAYER_1, 3041},  // 4 media players with their key
+      {UKEY_1, UKEY_4},
+      {DSK_1_MASK, 5040},    // 4 DSK masks
+      {SUPER_SOURCE, 6001},  // 2 super sources
+      {CLEAN_FEED_1, 7004},  // 4 clean feeds
+      {AUX_1, AUX_24},
+      {WEB_CAM_OUT, WEB_CAM_OUT},
+      {MULTIVIEW_1, MULTIVIEW_4},
+      {RECORDING_STATUS, AUDIO_STATUS},
+      {ME1_PROGRAM, 10041},  // 4 MEs with program and preview
+  };
+
+ public:
+  /// The amount of dense indices
+  static constexpr uint16_t kCount = [] {
+    uint16_t count = 0;
+    for (const Range& range : kRanges) count += range.last - range.first + 1;
+    return count;
+  }();
+};
+
+static_assert(SourceIndex::ToSource(SourceIndex::FromSource(ME4_PREVIEW)) ==
+                  ME4_PREVIEW,
+              "The dense index must map back to the same source");
+
+/**
+ * @brief The properties of all inputs (InPr) in a single array that's
+ * allocated once, in the order of the sources.
+ *
+ * @code
+ *  for (auto& [source, property] : atem_connection->GetInputProperties()) {
+ *    printf("%u: %.20s\n", source, property.Get().name_long);
+ *  }
+ * @endcode
+ */
+class InputTable {
+ public:
+  struct Entry {
+    Source source;
+    AtemState<InputProperty> property;
+  };
+
+  /**
+   * @brief Iterates over the entries ordered by source
+   */
+  class Iterator {
+   public:
+    Iterator(const InputTable* table, uint16_t index)
+        : table_(table), index_(index) {
+      this->Skip_();
+    }
+    const Entry& operator*() const {
+      return this->table_->entries_[this->table_->slots_[this->index_]];
+    }
+    const Entry* operator->() const { return &**this; }
+    Iterator& operator++() {
+      this->index_++;
+      this->Skip_();
+      return *this;
+    }
+    bool operator==(const Iterator& rhs) const {
+      return this->index_ == rhs.index_;
+    }
+
+   protected:
+    const InputTable* table_;
+    uint16_t index_;
+
+    // Move to the next index that's used
+    void Skip_() {
+      while (this->index_ < SourceIndex::kCount &&
+             this->table_->slots_[this->index_] == kEmpty)
+        this->index_++;
+    }
+  };
+
+  InputTable() { memset(this->slots_, kEmpty, sizeof(this->slots_)); }
+
+  /**
+   * @brief Allocate room for the amount of sources of the topology
+   *
+   * @param sources[in] Topology::sources
+   */
+  void Reserve(uint8_t sources) { this->entries_.reserve(sources); }
+  /**
+   * @brief Get the properties of a source
+   *
+   * @param source[in]
+   * @return const AtemState<InputProperty>* nullptr when the ATEM didn't
+   * send the properties of this source
+   */
+  const AtemState<InputProperty>* Find(Source source) const {
+    const uint16_t index = SourceIndex::FromSource(source);
+    if (index == SourceIndex::kInvalid || this->slots_[index] == kEmpty)
+      return nullptr;
+    return &this->entries_[this->slots_[index]].property;
+  }
+  /**
+   * @brief Check if the ATEM has send the properties of a source
+   *
+   * @param source[in]
+   * @return true When the source exists on this ATEM
+   */
+  bool Contains(Source source) const { return this->Find(source) != nullptr; }
+  /**
+   * @brief Set the properties of a source
+   *
+   * @param source[in]
+   * @param id[in] The packet id of the change
+   * @param property[in] The new properties
+   * @return bool false when the source isn't known or the data is older
+   */
+  bool Set(Source source, int16_t id, const InputProperty& property) {
+    const uint16_t index = SourceIndex::FromSource(source);
+    if (index == SourceIndex::kInvalid) return false;
+
+    if (this->slots_[index] == kEmpty) {
+      this->slots_[index] = this->entries_.size();
+      this->entries_.push_back({source, AtemState(id, property)});
+      return true;
+    }
+
+    return this->entries_[this->slots_[index]].property.Set(id, property);
+  }
+
+  /**
+   * @brief Get the amount of sources
+   *
+   * @return size_t
+   */
+  size_t size() const { return this->entries_.size(); }
+  Iterator begin() const { return Iterator(this, 0); }
+  Iterator end() const { return Iterator(this, SourceIndex::kCount); }
+
+ protected:
+  static constexpr uint8_t kEmpty = UINT8_MAX;
+  static_assert(SourceIndex::kCount < kEmpty,
+                "The index of every entry must fit in a slot");
+
+  // The index in entries_ of every dense index, kEmpty when not used
+  uint8_t slots_[SourceIndex::kCount];
+  std::vector<Entry> entries_;
+};
+
+}  // namespace atem
@@ -0,0 +1,106 @@
+/**
+ * @file seqlock.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief A sequence lock that lets any amount of tasks read a small value
+ * without ever blocking the task that writes it.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+namespace atem {
+
+/**
+ * @brief Stores a copy of T that can be read while it's written. The writer
+ * makes the sequence odd while writing, a reader retries when the sequence
+ * was odd or changed during its copy.
+ *
+ * The value is stored as atomic words, so a reader that races with the writer
+ * only reads a torn copy that it throws away.
+ *
+ * @warning Only a single task may write at the same time
+ *
+ * @tparam T A trivially copyable type
+ */
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Only trivially copyable types can be stored");
+
+ public:
+  SeqLock() { this->Write(T()); }
+
+  /**
+   * @brief Replace the value, this never blocks
+   *
+   * @param value[in] The new value
+   */
+  void Write(const T& value) {
+    uint32_t words[kWords] = {};
+    memcpy(words, &value, sizeof(T));
+
+    const uint32_t sequence = this->sequence_.load(std::memory_order_relaxed);
+    this->sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < kWords; i++)
+      this->data_[i].store(words[i], std::memory_order_relaxed);
+
+    this->sequence_.store(sequence + 2, std::memory_order_release);
+  }
+  /**
+   * @brief Get a consistent copy of the value
+   *
+   * @return T
+   */
+  T Read() const {
+    uint32_t words[kWords];
+
+    for (uint32_t attempt = 0;; attempt++) {
+      const uint32_t sequence =
+          this->sequence_.load(std::memory_order_acquire);
+
+      if ((sequence & 1) == 0) {
+        for (size_t i = 0; i < kWords; i++)
+          words[i] = this->data_[i].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->sequence_.load(std::memory_order_relaxed) == sequence) break;
+      }
+
+      // The writer may have a lower priority, give it time to finish
+      if (attempt >= kSpin) vTaskDelay(1);
+    }
+
+    T value;
+    memcpy(&value, words, sizeof(T));
+    return value;
+  }
+  /**
+   * @brief Get the amount of times the value has been written, this can be
+   * used to check for changes without copying the value.
+   *
+   * @return uint32_t
+   */
+  uint32_t GetVersion() const {
+    return this->sequence_.load(std::memory_order_acquire) / 2;
+  }
+
+ protected:
+  static constexpr size_t kWords = (sizeof(T) + 3) / 4;
+  // Attempts before the reader starts to sleep
+  static constexpr uint32_t kSpin = 8;
+
+  std::atomic<uint32_t> sequence_{0};
+  std::atomic<uint32_t> data_[kWords];
+};
+
+}  // namespace atem
@@ -69,6 +69,27 @@ class SequenceCheck {
 
     return -1;  // How did we get here?
   }
+  /**
+   * @brief Returns the highest id of which all previous ids have been
+   * received, this is the id that can be acknowledged.
+   *
+   * @return int16_t
+   */
+  int16_t GetLastInOrder() const {
+    if (this->received_ == UINT32_MAX) return this->offset_;
+
+    // The size of the received_ buffer in bits
+    const uint16_t recv_len = sizeof(this->received_) * 8;
+
+    // Find the oldest missing id, the id before it is the last in order
+    for (int16_t i = recv_len - 1; i >= 0; i--) {
+      if (!(this->received_ & 1u << i)) {
+        return ((this->offset_ - i - 1) & INT16_MAX);
+      }
+    }
+
+    return this->offset_;
+  }
   /**
    * @brief Returns the last id received (or added) using the Add function.
    *
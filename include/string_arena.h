@@ -0,0 +1,118 @@
+/**
+ * @file string_arena.h
+ * @author Wouter (atem_esp_idf@wjt.je)
+ * @brief Stores a string per index (e.g. the file names of the media pool) in
+ * a single buffer.
+ *
+ * @copyright Copyright (c) 2024 - Wouter (wjtje)
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace atem {
+
+/**
+ * @brief A table of strings that are stored behind each other in a single
+ * allocation. A new string is placed in the space of the previous string of
+ * the same index when it fits, otherwise it's appended. When the buffer is
+ * full the strings are compacted (and the buffer grown when that isn't
+ * enough).
+ *
+ * Every string has the packet id it was last changed in, just like
+ * AtemState.
+ */
+class StringArena {
+ public:
+  /// The space reserved per index by Reserve
+  static constexpr size_t kAverageLength = 32;
+
+  StringArena() {}
+  ~StringArena();
+  StringArena(const StringArena&) = delete;
+  StringArena& operator=(const StringArena&) = delete;
+  StringArena(StringArena&& other) noexcept;
+  StringArena& operator=(StringArena&& other) noexcept;
+
+  /**
+   * @brief Allocate room for count strings of kAverageLength
+   *
+   * @param count[in] The amount of indices (e.g. MediaPlayer::still)
+   */
+  void Reserve(uint16_t count);
+  /**
+   * @brief Set the string of an index
+   *
+   * @param index[in]
+   * @param id[in] The packet id of the change
+   * @param value[in] The string, nullptr to remove the string
+   * @param length[in] The length of the string without terminator
+   * @return bool false when the data is older or out of memory
+   */
+  bool Set(uint16_t index, int16_t id, const char* value, uint8_t length);
+  /**
+   * @brief Get the string of an index
+   *
+   * @param index[in]
+   * @return const char* A null terminated string, nullptr when not set
+   */
+  const char* Get(uint16_t index) const {
+    if (index >= this->count_ || !this->slots_[index].used) return nullptr;
+    return this->data_ + this->slots_[index].offset;
+  }
+  /**
+   * @brief Returns weather or not the ATEM has send the index
+   *
+   * @param index[in]
+   * @return bool
+   */
+  bool IsValid(uint16_t index) const {
+    return index < this->count_ && this->slots_[index].id != INT16_MIN;
+  }
+  /**
+   * @brief Returns the packet id when this index was last changed
+   *
+   * @param index[in]
+   * @return int16_t INT16_MIN when it has not been set
+   */
+  int16_t GetPacketId(uint16_t index) const {
+    return index < this->count_ ? this->slots_[index].id : INT16_MIN;
+  }
+  /**
+   * @brief Get the amount of indices
+   *
+   * @return uint16_t
+   */
+  uint16_t size() const { return this->count_; }
+
+ protected:
+  struct Slot {
+    int16_t id;
+    uint16_t offset;
+    // The space at offset including the terminator, 0 when there is none
+    uint16_t capacity;
+    // The length of the string without the terminator
+    uint8_t length;
+    bool used;
+  };
+
+  // The slots, directly followed by the strings
+  Slot* slots_{nullptr};
+  char* data_{nullptr};
+  uint16_t count_{0};
+  // The size of data_ and the amount of it that's in use
+  size_t size_{0};
+  size_t used_{0};
+
+  /**
+   * @brief Move all strings into a new buffer without the space that's no
+   * longer used
+   *
+   * @param count[in] The new amount of indices
+   * @param size[in] The new size of the strings
+   * @return bool false when out of memory, nothing is changed
+   */
+  bool Rebuild_(uint16_t count, size_t size);
+};
+
+}  // namespace atem
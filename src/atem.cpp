@@ -1,5 +1,9 @@
 #include "atem.h"
 
+#include <esp_rom_sys.h>
+
+#include <algorithm>
+
 namespace atem {
 
 static const char *TAG{"Atem"};
@@ -50,17 +54,50 @@ Atem::Atem(const char *address) {
     ESP_LOGE(TAG, "Failed to setsockopt (%s)", strerror(rv));
   }
 
-  // Pre allocate send vector
+  // Timer that sends the coalescing queue
+  const TickType_t interval = pdMS_TO_TICKS(CONFIG_ATEM_COALESCE_INTERVAL);
+  this->coalesce_timer_ = xTimerCreate(
+      "atem_coalesce", std::max<TickType_t>(1, interval), pdFALSE, this,
+      [](TimerHandle_t timer) {
+        ((Atem *)pvTimerGetTimerID(timer))->FlushCoalesced_();
+      });
+
 #if CONFIG_ATEM_STORE_SEND
-  if (xSemaphoreTake(this->send_mutex_, pdMS_TO_TICKS(50))) {
-    this->send_packets_.reserve(32);
-    xSemaphoreGive(this->send_mutex_);
-  } else {
-    ESP_LOGE(TAG, "Failed to pre allocate send packet buffer");
-  }
+  // Timer that sends unacknowledged packets again
+  this->rto_timer_ = xTimerCreate(
+      "atem_rto", pdMS_TO_TICKS(CONFIG_ATEM_RTO_MAX), pdFALSE, this,
+      [](TimerHandle_t timer) {
+        ((Atem *)pvTimerGetTimerID(timer))->RetransmitExpired_();
+      });
 #endif
 
-  // Create background task
+  // Buffers for the packets that are waiting to be parsed
+  this->rx_buffer_ = (char *)malloc(CONFIG_ATEM_RX_RING_SIZE *
+                                    CONFIG_PACKET_BUFFER_SIZE);
+  if (this->rx_buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate receive buffers");
+    return;
+  }
+
+  // Create background tasks, the parser must exist before packets arrive
+  if (unlikely(!xTaskCreatePinnedToCore(
+          [](void *a) { ((Atem *)a)->parse_task_(); }, "atem_parse", 5 * 1024,
+          this, configMAX_PRIORITIES - 2, &this->parse_task_handle_,
+          CONFIG_ATEM_PARSER_TASK_CORE < 0 ? tskNO_AFFINITY
+                                           : CONFIG_ATEM_PARSER_TASK_CORE))) {
+    ESP_LOGE(TAG, "Failed to create parser task");
+    return;
+  }
+
+  this->tx_queue_ = xQueueCreate(CONFIG_ATEM_TX_QUEUE_SIZE, sizeof(TxItem));
+  if (unlikely(this->tx_queue_ == nullptr ||
+               !xTaskCreate([](void *a) { ((Atem *)a)->tx_task_(); },
+                            "atem_tx", 3 * 1024, this, configMAX_PRIORITIES - 1,
+                            &this->tx_task_handle_))) {
+    ESP_LOGE(TAG, "Failed to create transmit task");
+    return;
+  }
+
   if (unlikely(!xTaskCreate([](void *a) { ((Atem *)a)->task_(); }, "atem",
                             5 * 1024, this, configMAX_PRIORITIES - 1,
                             &this->task_handle_))) {
@@ -75,40 +112,75 @@ Atem::~Atem() {
   if (this->task_handle_ != nullptr) {
     vTaskDelete(this->task_handle_);
   }
+  if (this->parse_task_handle_ != nullptr) {
+    vTaskDelete(this->parse_task_handle_);
+  }
+  if (this->tx_task_handle_ != nullptr) vTaskDelete(this->tx_task_handle_);
+  if (this->tx_queue_ != nullptr) {
+    TxItem item;
+    while (xQueueReceive(this->tx_queue_, &item, 0)) {
+      AtemPacket::Adopt(item.data);  // Give the buffer back
+#if CONFIG_ATEM_STORE_SEND
+      // The packet will never be send
+      if (item.callback != nullptr)
+        item.callback(ESP_ERR_INVALID_STATE, 0, item.arg);
+#endif
+    }
+    vQueueDelete(this->tx_queue_);
+  }
+  free(this->rx_buffer_);
+  if (this->coalesce_timer_ != nullptr) {
+    xTimerDelete(this->coalesce_timer_, portMAX_DELAY);
+  }
 
   // Clear cached packages
 #if CONFIG_ATEM_STORE_SEND
-  xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
-  for (auto p : this->send_packets_) delete p;
-  this->send_packets_.clear();
-  xSemaphoreGive(this->send_mutex_);
+  this->ClearSendPackets_();
+  if (this->rto_timer_ != nullptr) {
+    xTimerDelete(this->rto_timer_, portMAX_DELAY);
+  }
 #endif
 
   // Clear memory
   xSemaphoreTake(this->state_mutex_, portMAX_DELAY);
-  for (auto &file : this->media_player_file_) {
-    if (file.second.IsValid()) {
-      free(file.second.Get());
-    }
-  }
-  this->media_player_file_.clear();
+  this->switcher_.Reset();
   xSemaphoreGive(this->state_mutex_);
+  this->staging_.Reset();
 }
 
 // MARK: Background task
 
 void Atem::task_() {
-  char buffer[CONFIG_PACKET_BUFFER_SIZE];
-  AtemPacket packet(buffer);
   int ack_count = 0, len;
-  uint32_t boot_events = 0;
+  // The initial state is complete, but there was no slot to tell the parser
+  bool ready = false;
 
   for (;;) {
-    // Get length of next package
-    len = recv(this->sockfd_, packet.GetData(), 2, MSG_PEEK);
+    // The slot at the head is never used by the parser task
+    const size_t head = this->rx_head_.load(std::memory_order_relaxed);
+    const size_t next = (head + 1) % CONFIG_ATEM_RX_RING_SIZE;
+    AtemPacket packet = this->GetRxPacket_(head);
+
+#if CONFIG_ATEM_DELAYED_ACK
+    // Don't wait for the next packet while there are packets to acknowledge
+    const int flags = this->ack_pending_ != 0 ? MSG_DONTWAIT : 0;
+#else
+    const int flags = 0;
+#endif
+
+    // Get the next packet, a datagram is always received as a whole
+    len = recv(this->sockfd_, packet.GetData(), CONFIG_PACKET_BUFFER_SIZE,
+               flags);
 
     // Something went wrong
     if (len < 0) {
+#if CONFIG_ATEM_DELAYED_ACK
+      if (flags & MSG_DONTWAIT && errno == EAGAIN) {
+        this->SendAck_();  // End of the burst
+        continue;
+      }
+#endif
+
       if (errno != EAGAIN) {
         ESP_LOGE(TAG, "recv error: %s (%i)", strerror(errno), errno);
         continue;
@@ -121,565 +193,552 @@ void Atem::task_() {
         }
 
         this->Reconnect_();
+        ready = false;
         continue;
       }
 
-      // Send ACK-RESPONSE to test connection
-      if (this->Connected()) {
-        AtemPacket p = AtemPacket(0x11, this->session_id_, 12);
-        p.SetId(++this->local_id_);
-        p.SetAckId(this->remote_id_);
-        this->SendPacket_(&p);
+      // Send ACK-RESPONSE to test connection, the transmit task gives it an id
+      if (this->state_ == ConnectionState::kActive) {
+        const TxItem item = {nullptr, nullptr, nullptr};
+        xQueueSend(this->tx_queue_, &item, 0);
       }
 
       ack_count++;
       continue;
     }
 
-    int recv_len = packet.GetLength();
-    if (recv_len > sizeof(buffer)) {
-      ESP_LOGE(TAG,
-               "Next package (len: %i) is larger than the buffer (len: %u)",
-               recv_len, sizeof(buffer));
-      recv_len = sizeof(buffer);
+    ack_count = 0;
+
+    // The protocol is always handled, only a packet with commands needs a
+    // slot. A pending ready marker takes the slot of this packet, so no
+    // commands are accepted until it's handed to the parser.
+    const bool full = next == this->rx_tail_.load(std::memory_order_acquire);
+    const bool staged = this->state_ != ConnectionState::kActive;
+    RxSlot &slot = this->rx_slots_[head];
+
+    const bool parse = this->HandlePacket_(packet, len, !full && !ready);
+    if (staged && this->state_ == ConnectionState::kActive) ready = true;
+
+#if CONFIG_ATEM_DELAYED_ACK
+    if (this->ack_pending_ >= CONFIG_ATEM_DELAYED_ACK_PACKETS ||
+        (this->ack_pending_ != 0 &&
+         esp_timer_get_time() - this->ack_time_ >=
+             CONFIG_ATEM_DELAYED_ACK_TIME * 1000)) {
+      this->SendAck_();
     }
+#endif
 
-    // Get next packet
-    if ((len = recv(this->sockfd_, packet.GetData(), recv_len, 0)) < 0) {
-      ESP_LOGE(TAG, "recv error: %s (%i)", strerror(errno), errno);
+    if (parse) {
+      slot.type = staged ? RxSlotType::kStaged : RxSlotType::kLive;
+      slot.id = packet.GetFlags() & 0x1 ? packet.GetId()
+                                        : this->sqeuence_.GetLastId();
+    } else if (ready && !full) {
+      slot.type = RxSlotType::kReady;
+      slot.id = this->remote_id_;
+      ready = false;
+    } else {
       continue;
     }
 
-    ack_count = 0;
+    // Hand the packet to the parser task
+    slot.generation = this->generation_.load(std::memory_order_relaxed);
+    this->rx_head_.store(next, std::memory_order_release);
+    xTaskNotifyGive(this->parse_task_handle_);
+  }
 
-    // Check Length
-    if (packet.GetLength() != len) {
-      ESP_LOGW(TAG, "Received packet with invalid size (%u instead of %u)", len,
-               packet.GetLength());
-      continue;
-    }
+  vTaskDelete(nullptr);
+}
 
-    ESP_LOGD(TAG, "<- Flags: %02X, ACK: %04X, Resend: %04X, Id: %04X, Len: %u",
-             packet.GetFlags(), packet.GetAckId(), packet.GetResendId(),
-             packet.GetId(), packet.GetLength());
+void Atem::parse_task_() {
+  uint32_t generation = 0;
 
-    // Check session id
-    if (this->state_ == ConnectionState::kActive &&
-        packet.GetSessionId() != this->session_id_) {
-      ESP_LOGW(TAG,
-               "Received packet with invalid session (%02x instead of %02x)",
-               packet.GetSessionId(), this->session_id_);
-      continue;
-    }
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    size_t tail = this->rx_tail_.load(std::memory_order_relaxed);
+    size_t head = this->rx_head_.load(std::memory_order_acquire);
+
+    while (tail != head) {
+      const RxSlot &first = this->rx_slots_[tail];
 
-    // INIT packet
-    if (packet.GetFlags() & 0x2 && this->state_ != ConnectionState::kActive) {
-      ESP_LOGD(TAG, "Received INIT");
-      uint8_t init_status = ((const uint8_t *)packet.GetData())[12];
-
-      if (init_status == 0x2) {  // INIT accepted
-        this->local_id_ = 0;
-        this->remote_id_ = 0;
-        this->state_ = ConnectionState::kInitializing;
-        AtemPacket p = AtemPacket(0x10, packet.GetSessionId(), 12);
-        this->SendPacket_(&p);
-      } else if (init_status == 0x3) {  // No connection available
-        ESP_LOGW(TAG,
-                 "Couldn't connect to the atem because it has no connection "
-                 "slot available");
-      } else {
-        ESP_LOGW(TAG, "Received an unknown INIT status (%02x)", init_status);
+      // Packets from a previous connection are ignored
+      if (first.generation != this->generation_.load()) {
+        tail = (tail + 1) % CONFIG_ATEM_RX_RING_SIZE;
+        this->rx_tail_.store(tail, std::memory_order_release);
+        continue;
       }
-    }
 
-    // INIT packets complete
-    if (this->state_ == ConnectionState::kInitializing &&
-        packet.GetFlags() & 0x1 && packet.GetLength() == 12) {
-      ESP_LOGI(TAG, "Initialization done");
-      this->session_id_ = packet.GetSessionId();
-      this->state_ = ConnectionState::kActive;
-
-      // Send event's
-      uint16_t packet_id = 1;  // Init packet ID
-      for (int32_t i = 0; i < sizeof(boot_events) * 8; i++) {
-        if (boot_events & 1 << i) {
-          ESP_ERROR_CHECK_WITHOUT_ABORT(
-              esp_event_post(ATEM_EVENT, i, &packet_id, sizeof(packet_id), 0));
-        }
+      // Start with a clean initial state on every connection
+      if (first.generation != generation) {
+        this->staging_.Reset();
+        generation = first.generation;
       }
-    }
 
-    // RESEND request
-    if (packet.GetFlags() & 0x8 && this->state_ == ConnectionState::kActive) {
-      ESP_LOGW(TAG, "<- Resend request for %u", packet.GetResendId());
-      bool send = false;
+      if (first.type == RxSlotType::kReady) {
+        this->SwapInState_(first.id);
+        tail = (tail + 1) % CONFIG_ATEM_RX_RING_SIZE;
+        this->rx_tail_.store(tail, std::memory_order_release);
+        continue;
+      }
 
-      // Try to find the packet
-#if CONFIG_ATEM_STORE_SEND
-      if (xSemaphoreTake(this->send_mutex_, 50 / portTICK_PERIOD_MS)) {
-        int16_t id = packet.GetId();
-        for (int i = 0; AtemPacket * p : this->send_packets_) {
-          if (i++ > 50) break;  // Limit to max 50 loops
-
-          if (p->GetId() == id) {
-            this->SendPacket_(p);
-            send = true;
-            break;
-          }
+      // Parse all packets of the same type at once, the initial state is
+      // parsed without locking
+      const bool staged = first.type == RxSlotType::kStaged;
+      if (!staged) {
+        while (!xSemaphoreTake(this->state_mutex_, 150 / portTICK_PERIOD_MS)) {
+          ESP_LOGW(TAG,
+                   "Failed to lock access to the state, make sure you only "
+                   "lock the state for max 100ms.");
         }
+      }
 
-        xSemaphoreGive(this->send_mutex_);
+      // The initial state isn't journaled, it's all new
+      parser::Context ctx{
+          .state = staged ? this->staging_ : this->switcher_,
+          .id = first.id,
+          .journal = staged ? nullptr : &this->journal_};
+      xSemaphoreTake(this->hook_mutex_, portMAX_DELAY);
+      for (; tail != head && this->rx_slots_[tail].type == first.type &&
+             this->rx_slots_[tail].generation == first.generation;
+           tail = (tail + 1) % CONFIG_ATEM_RX_RING_SIZE) {
+        AtemPacket packet = this->GetRxPacket_(tail);
+        ctx.id = this->rx_slots_[tail].id;
+        this->ParsePacket_(packet, ctx);
       }
-#endif
+      xSemaphoreGive(this->hook_mutex_);
+
+      if (!staged) {
+        this->PublishSnapshot_(ctx.id);
+        xSemaphoreGive(this->state_mutex_);  // unlock the access
+      }
+      this->rx_tail_.store(tail, std::memory_order_release);
 
-      // We don't have this packet, just pretend it was an ACK
-      if (!send) {
-        AtemPacket p = AtemPacket(0x1, packet.GetSessionId(), 12);
-        p.SetId(packet.GetResendId());
-        this->SendPacket_(&p);
+      // Send events, the initial state sends all events once it's swapped in
+      if (!staged) {
+        for (int32_t i = 0; i < sizeof(ctx.event) * 8; i++) {
+          if (!(ctx.event & 1 << i)) continue;
+
+          AtemEventData data = {uint16_t(ctx.id), ctx.dirty[i]};
+          ESP_ERROR_CHECK_WITHOUT_ABORT(
+              esp_event_post(ATEM_EVENT, i, &data, sizeof(data), 0));
+        }
       }
+
+      // Pick up the packets that arrived while parsing
+      head = this->rx_head_.load(std::memory_order_acquire);
     }
+  }
 
-    // Send ACK
-    if (packet.GetFlags() & 0x1) {
-      this->remote_id_ = packet.GetId();
-      bool should_parse_packet = true;
+  vTaskDelete(nullptr);
+}
 
-      AtemPacket p = AtemPacket(0x10, packet.GetSessionId(), 12);
-      p.SetAckId(this->remote_id_);
+void Atem::tx_task_() {
+  TxItem item;
 
-      if (!this->sqeuence_.Add(packet.GetId())) {
-        ESP_LOGD(TAG, "Received duplicate packet with id %u", packet.GetId());
-        should_parse_packet = false;  // We can ignore this packet
-      }
+  for (;;) {
+    xQueueReceive(this->tx_queue_, &item, portMAX_DELAY);
 
-      // Check if we are receiving it in order
-      const int16_t missing_id = this->sqeuence_.GetMissing();
-      if (missing_id >= 0) {
-        ESP_LOGW(TAG, "Missing packet %u, trying to request it", missing_id);
+    // Keepalive, this isn't stored
+    if (item.data == nullptr) {
+      AtemPacket p = AtemPacket(0x11, this->session_id_, 12);
+      p.SetId(this->NextLocalId_());
+      p.SetAckId(this->remote_id_);
+      this->SendPacket_(&p);
+      continue;
+    }
 
-        // Request missing
-        p.SetFlags(p.GetFlags() | 0x8);
-        p.SetResendId(missing_id);
-        p.SetId(0);
-        p.SetUnknown(0x100);
-      }
+    AtemPacket packet = AtemPacket::Adopt(item.data);
+#if CONFIG_ATEM_STORE_SEND
+    // Packets queued while waiting can be merged into this one
+    this->WaitForWindow_(packet.GetLength());
+#endif
 
-      if (state_ == ConnectionState::kActive || missing_id >= 0) {
-        this->SendPacket_(&p);
-      }
+    const AckTarget target = {item.callback, item.arg};
+#if CONFIG_ATEM_TX_BATCHING
+    this->SendMerged_(std::move(packet), target);
+#else
+    this->Transmit_(std::move(packet), &target, target.callback != nullptr);
+#endif
+  }
+}
 
-      if (!should_parse_packet) continue;
+void Atem::Transmit_(AtemPacket &&packet, const AckTarget *callbacks,
+                     size_t count) {
+#if CONFIG_ATEM_TX_PACING
+  // Spread bursts of packets
+  const int64_t gap = esp_timer_get_time() - this->tx_last_;
+  if (gap < CONFIG_ATEM_TX_PACING) {
+    const uint32_t wait = CONFIG_ATEM_TX_PACING - gap;
+    if (wait >= portTICK_PERIOD_MS * 1000) {
+      vTaskDelay(wait / (portTICK_PERIOD_MS * 1000));
+    } else {
+      esp_rom_delay_us(wait);
     }
+  }
+  this->tx_last_ = esp_timer_get_time();
+#endif
 
+  // The session may have changed while the packet was queued
+  packet.SetSessionId(this->session_id_);
 #if CONFIG_ATEM_STORE_SEND
-    // Receive ACK
-    if (packet.GetFlags() & 0x10 && this->state_ == ConnectionState::kActive) {
-      if (xSemaphoreTake(this->send_mutex_, 50 / portTICK_PERIOD_MS)) {
-        int16_t id = packet.GetAckId();
-        int i = 0;
-
-        for (std::vector<AtemPacket *>::iterator it =
-                 this->send_packets_.begin();
-             it != this->send_packets_.end();) {
-          if (i++ > 50) break;  // Limit to max 50 loops
-
-          // Remove all packets older than 32
-          if ((((*it)->GetId() - id) & 0x7FFF) > 32 &&
-              ((id - (*it)->GetId()) & 0x7FFF) > 32) {
-            ESP_LOGD(TAG, "Removing packet with id %i because it's to old",
-                     (*it)->GetId());
-            delete (*it);
-            it = this->send_packets_.erase(it);
-          } else if ((*it)->GetId() == id) {
-            delete (*it);
-            it = this->send_packets_.erase(it);
-            break;
-          } else {
-            ++it;
-          }
-        }
+  this->SendStoredPacket_(std::move(packet), callbacks, count);
+#else
+  this->SendStoredPacket_(std::move(packet));
+#endif
+}
 
-        xSemaphoreGive(this->send_mutex_);
-      } else {
-        ESP_LOGW(TAG, "Failed to note of ACK");
-      }
+#if CONFIG_ATEM_TX_BATCHING
+void Atem::SendMerged_(AtemPacket &&packet, const AckTarget &target) {
+  TxItem batch[CONFIG_ATEM_TX_QUEUE_SIZE];
+  AckTarget callbacks[kMaxCallbacks];
+  size_t count = 0, callback_count = 0;
+  uint16_t length = packet.GetLength();
+  if (target.callback != nullptr) callbacks[callback_count++] = target;
+
+  // Wait a short time for other packets that fit in the same packet, the
+  // deadline is in us since the window is often shorter than a tick
+  const int64_t end =
+      esp_timer_get_time() + CONFIG_ATEM_TX_BATCH_WINDOW * 1000LL;
+  while (count < CONFIG_ATEM_TX_QUEUE_SIZE) {
+    const bool open = esp_timer_get_time() < end;
+    TxItem next;
+
+    if (!xQueuePeek(this->tx_queue_, &next, open ? 1 : 0)) {
+      if (open) continue;
+      break;
     }
+
+    // Keepalives are send on their own, the callbacks of a packet must fit
+    if (next.data == nullptr) break;
+    if (next.callback != nullptr && callback_count == kMaxCallbacks) break;
+    AtemPacket p(next.data);
+    if (length + p.GetLength() - 12 > kTxMtu) break;
+
+    xQueueReceive(this->tx_queue_, &next, 0);
+    batch[count++] = next;
+    length += p.GetLength() - 12;
+    if (next.callback != nullptr)
+      callbacks[callback_count++] = {next.callback, next.arg};
+  }
+
+  if (count == 0) {
+    this->Transmit_(std::move(packet), callbacks, callback_count);
+    return;
+  }
+
+  // Copy all commands into a single packet
+  AtemPacket merged(0x1, this->session_id_, length);
+  uint8_t *data = (uint8_t *)merged.GetData();
+  if (unlikely(data == nullptr)) {
+    // Out of memory, send every packet on its own so none is lost
+    ESP_LOGW(TAG, "Failed to merge %zu packets", count + 1);
+    this->Transmit_(std::move(packet), &target, target.callback != nullptr);
+    for (size_t i = 0; i < count; i++) {
+      AtemPacket p = AtemPacket::Adopt(batch[i].data);
+      const AckTarget t = {batch[i].callback, batch[i].arg};
+#if CONFIG_ATEM_STORE_SEND
+      this->WaitForWindow_(p.GetLength());
 #endif
+      this->Transmit_(std::move(p), &t, t.callback != nullptr);
+    }
+    return;
+  }
+
+  memcpy(data + 12, (uint8_t *)packet.GetData() + 12,
+         packet.GetLength() - 12);
+  data += packet.GetLength();
+  for (size_t i = 0; i < count; i++) {
+    AtemPacket p = AtemPacket::Adopt(batch[i].data);
+    memcpy(data, (uint8_t *)p.GetData() + 12, p.GetLength() - 12);
+    data += p.GetLength() - 12;
+  }
 
-    // Check size of packet
-    if (len <= 12 || packet.GetFlags() & 0x2) continue;
+  ESP_LOGD(TAG, "Merged %zu packets into a single packet (%u bytes)",
+           count + 1, length);
+  this->Transmit_(std::move(merged), callbacks, callback_count);
+}
+#endif
 
-    // Parse packet
-    uint32_t event = 0;
+bool Atem::HandlePacket_(AtemPacket &packet, int len, bool room) {
+  // Check Length, the packet header is always 12 bytes
+  if (len < 12) {
+    ESP_LOGW(TAG, "Received packet without a valid header (len: %i)", len);
+    return false;
+  }
 
-    // Initialize common variables
-    uint8_t me, keyer, channel, mediaplayer;
-    size_t len;
-    Source source;
+  // The rest of a datagram that doesn't fit in the buffer is discarded
+  if (packet.GetLength() > CONFIG_PACKET_BUFFER_SIZE) {
+    ESP_LOGE(TAG,
+             "Received package (len: %u) is larger than the buffer (len: %u)",
+             packet.GetLength(), CONFIG_PACKET_BUFFER_SIZE);
+    return false;
+  }
 
-    // Lock access to the state
-    if (!xSemaphoreTake(this->state_mutex_, 150 / portTICK_PERIOD_MS)) {
+  if (packet.GetLength() != len) {
+    ESP_LOGW(TAG, "Received packet with invalid size (%u instead of %u)", len,
+             packet.GetLength());
+    return false;
+  }
+
+  ESP_LOGD(TAG, "<- Flags: %02X, ACK: %04X, Resend: %04X, Id: %04X, Len: %u",
+           packet.GetFlags(), packet.GetAckId(), packet.GetResendId(),
+           packet.GetId(), packet.GetLength());
+
+  // Check session id
+  if (this->state_ == ConnectionState::kActive &&
+      packet.GetSessionId() != this->session_id_) {
+    ESP_LOGW(TAG,
+             "Received packet with invalid session (%02x instead of %02x)",
+             packet.GetSessionId(), this->session_id_);
+    return false;
+  }
+
+  // INIT packet
+  if (packet.GetFlags() & 0x2 && this->state_ != ConnectionState::kActive) {
+    ESP_LOGD(TAG, "Received INIT");
+    uint8_t init_status = ((const uint8_t *)packet.GetData())[12];
+
+    if (init_status == 0x2) {  // INIT accepted
+      this->local_id_reset_.store(true, std::memory_order_release);
+      this->remote_id_ = 0;
+      this->state_ = ConnectionState::kInitializing;
+      AtemPacket p = AtemPacket(0x10, packet.GetSessionId(), 12);
+      this->SendPacket_(&p);
+    } else if (init_status == 0x3) {  // No connection available
       ESP_LOGW(TAG,
-               "Failed to lock access to the state, make sure you only lock "
-               "the state for max 100ms.");
-      continue;
+               "Couldn't connect to the atem because it has no connection "
+               "slot available");
+    } else {
+      ESP_LOGW(TAG, "Received an unknown INIT status (%02x)", init_status);
     }
+  }
 
-    for (int i = 0; AtemCommand command : packet) {
-      if (++i > 512) {  // Limit 512 command in a single packet
-        ESP_LOGE(TAG, "To many commands in one package");
-        break;
+  // INIT packets complete
+  if (this->state_ == ConnectionState::kInitializing &&
+      packet.GetFlags() & 0x1 && packet.GetLength() == 12) {
+    ESP_LOGI(TAG, "Initialization done");
+    this->session_id_ = packet.GetSessionId();
+    this->state_ = ConnectionState::kActive;
+  }
+
+  // RESEND request
+  if (packet.GetFlags() & 0x8 && this->state_ == ConnectionState::kActive) {
+    ESP_LOGW(TAG, "<- Resend request for %u", packet.GetResendId());
+    bool send = false;
+
+    // Try to find the packet
+#if CONFIG_ATEM_STORE_SEND
+    if (xSemaphoreTake(this->send_mutex_, 50 / portTICK_PERIOD_MS)) {
+      // Send the requested packet and all packets after it
+      int16_t id = packet.GetResendId();
+      for (int i = 0; i < CONFIG_ATEM_STORE_SEND_SIZE; i++) {
+        AtemPacket *p = this->GetSendPacket_(id);
+        if (p == nullptr) break;
+
+        this->SendPacket_(p);
+        send = true;
+        id = (id + 1) & 0x7FFF;
       }
 
-      switch (ATEM_CMD(((char *)command.GetCmd()))) {
-        case ATEM_CMD("_mpl"): {  // Media Player
-          event |= 1 << ATEM_EVENT_MEDIA_PLAYER;
+      xSemaphoreGive(this->send_mutex_);
+    }
+#endif
 
-          const MediaPlayer media_player = {
-              .still = command.GetData<uint8_t *>()[0],
-              .clip = command.GetData<uint8_t *>()[1],
-          };
-          this->media_player_.Set(this->sqeuence_, media_player);
-          break;
-        }
-        case ATEM_CMD("_MeC"): {  // Mix Effect Config
-          event |= 1 << ATEM_EVENT_TOPOLOGY;
-          uint8_t me = command.GetData(0);
-          uint8_t num_keyer = command.GetData(1);
-
-          if (this->mix_effect_.size() <= me) break;
-          this->mix_effect_[me].keyer.resize(num_keyer);
-          break;
-        }
-        case ATEM_CMD("_ver"): {  // Protocol version
-          event |= 1 << ATEM_EVENT_PROTOCOL_VERSION;
-
-          const ProtocolVersion version = {
-              .major = command.GetDataS<uint16_t>(0),
-              .minor = command.GetDataS<uint16_t>(1),
-          };
-          this->version_.Set(this->sqeuence_, version);
-          break;
-        }
-        case ATEM_CMD("_pin"): {  // Product Id
-          event |= 1 << ATEM_EVENT_PRODUCT_ID;
-          memcpy(this->product_id_, command.GetData<char *>(),
-                 sizeof(this->product_id_));
-
-          len = strlen(command.GetData<char *>());
-          if (len > 44) len = 44;
-          memset(this->product_id_ + len, 0, sizeof(this->product_id_) - len);
-          break;
-        }
-        case ATEM_CMD("_top"): {  // Topology
-          event |= 1 << ATEM_EVENT_TOPOLOGY;
-
-          const Topology top = {
-              .me = command.GetData(0),
-              .sources = command.GetData(1),
-              .dsk = command.GetData(2),
-              .aux = command.GetData(3),
-              .mixminus_outputs = command.GetData(4),
-              .mediaplayers = command.GetData(5),
-              .multiviewers = command.GetData(6),
-              .rs485 = command.GetData(7),
-              .hyperdecks = command.GetData(8),
-              .dve = command.GetData(9),
-              .stingers = command.GetData(10),
-              .supersources = command.GetData(11),
-              .talkback_channels = command.GetData(13),
-              .camera_control = command.GetData(18),
-          };
-          topology_.Set(this->sqeuence_, top);
-
-          // Resize buffers
-          this->mix_effect_.resize(top.me);
-          this->dsk_.resize(top.dsk);
-          this->aux_out_.resize(top.aux);
-          this->media_player_source_.resize(top.mediaplayers);
-          break;
-        }
-        case ATEM_CMD("AuxS"): {  // AUX Select
-          event |= 1 << ATEM_EVENT_AUX;
-          channel = command.GetData<uint8_t *>()[0];
-          if (this->aux_out_.size() <= channel) break;
-
-          this->aux_out_[channel].Set(this->sqeuence_,
-                                      command.GetDataS<Source>(1));
-          break;
-        }
-        case ATEM_CMD("DskB"): {  // DSK Source
-          event |= 1 << ATEM_EVENT_DSK;
-          keyer = command.GetData(0);
-          if (this->dsk_.size() <= keyer) break;
-
-          const DskSource source = {
-              .fill = command.GetDataS<Source>(1),
-              .key = command.GetDataS<Source>(2),
-          };
-          this->dsk_[keyer].source.Set(this->sqeuence_, source);
-          break;
-        }
-        case ATEM_CMD("DskP"): {  // DSK Properties
-          event |= 1 << ATEM_EVENT_DSK;
-          keyer = command.GetData<uint8_t *>()[0];
-          if (this->dsk_.size() <= keyer) break;
-
-          const DskProperties properties{
-              .tie = bool(command.GetData(1)),
-          };
-          this->dsk_[keyer].properties.Set(this->sqeuence_, properties);
-          break;
-        }
-        case ATEM_CMD("DskS"): {  // DSK State
-          event |= 1 << ATEM_EVENT_DSK;
-          keyer = command.GetData<uint8_t *>()[0];
-          if (this->dsk_.size() <= keyer) break;
-
-          const DskState state = {
-              .on_air = bool(command.GetData(1)),
-              .in_transition = bool(command.GetData(2)),
-              .is_auto_transitioning = bool(command.GetData(3)),
-          };
-          this->dsk_[keyer].state.Set(this->sqeuence_, state);
-          break;
-        }
-        case ATEM_CMD("FtbS"): {  // Fade to black State
-          event |= 1 << ATEM_EVENT_FADE_TO_BLACK;
-          me = command.GetData<uint8_t *>()[0];
-
-          const FadeToBlack ftb = {
-              .fully_black = bool(command.GetData<uint8_t *>()[1]),
-              .in_transition = bool(command.GetData<uint8_t *>()[2]),
-          };
-
-          if (this->mix_effect_.size() <= me) break;
-          this->mix_effect_[me].ftb.Set(this->sqeuence_, ftb);
-          break;
-        }
-        case ATEM_CMD("InPr"): {  // Input Property
-          event |= 1 << ATEM_EVENT_INPUT_PROPERTIES;
-          source = command.GetDataS<Source>(0);
-
-          InputProperty inpr;
-          memset(&inpr, 0, sizeof(inpr));
-
-          // Copy name long
-          len = strnlen(command.GetData<char *>() + 2, sizeof(inpr.name_long));
-          memcpy(inpr.name_long, command.GetData<uint8_t *>() + 2, len);
-
-          // Copy name short
-          len =
-              strnlen(command.GetData<char *>() + 22, sizeof(inpr.name_short));
-          memcpy(inpr.name_short, command.GetData<uint8_t *>() + 22,
-                 sizeof(inpr.name_short));
-
-          // Store inpr
-          auto it = input_properties_.find(source);
-          if (it != this->input_properties_.end()) {
-            (*it).second.Set(this->sqeuence_, inpr);
-          } else {
-            input_properties_.insert(
-                {source, AtemState(this->sqeuence_, inpr)});
-          }
-
-          break;
-        }
-        case ATEM_CMD("KeBP"): {  // Usk properties
-          event |= 1 << ATEM_EVENT_USK;
-          me = command.GetData<uint8_t *>()[0];
-          keyer = command.GetData<uint8_t *>()[1];
-
-          // Check if we have allocated memory for this
-          if (this->mix_effect_.size() <= me) break;
-          if (this->mix_effect_[me].keyer.size() <= keyer) break;
-
-          const UskState state = {
-              .type = command.GetData<uint8_t *>()[2],
-              .fill = (Source)ntohs(command.GetData<uint16_t *>()[3]),
-              .key = (Source)ntohs(command.GetData<uint16_t *>()[4]),
-              .top = int16_t(ntohs(command.GetData<uint16_t *>()[6])),
-              .bottom = int16_t(ntohs(command.GetData<uint16_t *>()[7])),
-              .left = int16_t(ntohs(command.GetData<uint16_t *>()[8])),
-              .right = int16_t(ntohs(command.GetData<uint16_t *>()[9])),
-          };
-
-          this->mix_effect_[me].keyer[keyer].state.Set(this->sqeuence_, state);
-          break;
-        }
-        case ATEM_CMD("KeDV"): {  // Usk properties DVE
-          event |= 1 << ATEM_EVENT_USK_DVE;
-          me = command.GetData<uint8_t *>()[0];
-          keyer = command.GetData<uint8_t *>()[1];
-
-          // Check if we have allocated memory for this
-          if (this->mix_effect_.size() <= me) break;
-          if (this->mix_effect_[me].keyer.size() <= keyer) break;
-
-          const DveState properties = {
-              .size_x = (int)ntohl(command.GetData<uint32_t *>()[1]),
-              .size_y = (int)ntohl(command.GetData<uint32_t *>()[2]),
-              .pos_x = (int)ntohl(command.GetData<uint32_t *>()[3]),
-              .pos_y = (int)ntohl(command.GetData<uint32_t *>()[4]),
-              .rotation = (int)ntohl(command.GetData<uint32_t *>()[5]),
-          };
-          this->mix_effect_[me].keyer[keyer].dve.Set(this->sqeuence_,
-                                                     properties);
-          break;
-        }
-        case ATEM_CMD("KeFS"): {  // Usk Fly State
-          event |= 1 < ATEM_EVENT_USK;
-          me = command.GetData<uint8_t *>()[0];
-          keyer = command.GetData<uint8_t *>()[1];
-
-          // Check if we have allocated memory for this
-          if (this->mix_effect_.size() <= me) break;
-          if (this->mix_effect_[me].keyer.size() <= keyer) break;
-
-          this->mix_effect_[me].keyer[keyer].at_key_frame.Set(
-              this->sqeuence_, command.GetData<uint8_t *>()[6]);
-          break;
-        }
-        case ATEM_CMD("KeOn"): {  // Key on Air
-          event |= 1 << ATEM_EVENT_USK;
-          me = command.GetData<uint8_t *>()[0];
-          keyer = command.GetData<uint8_t *>()[1];
+    // We don't have this packet, just pretend it was an ACK
+    if (!send) {
+      AtemPacket p = AtemPacket(0x1, packet.GetSessionId(), 12);
+      p.SetId(packet.GetResendId());
+      this->SendPacket_(&p);
+    }
+  }
 
-          // Check if we have allocated memory for this
-          if (this->mix_effect_.size() <= me) break;
-          if (keyer > 15) break;
+  // Don't ACK a packet with commands when there is no room to parse it, the
+  // ATEM will send it again
+  const bool commands = len > 12 && !(packet.GetFlags() & 0x2);
+  if (packet.GetFlags() & 0x1 && commands && !room) {
+    ESP_LOGW(TAG, "Parser can't keep up, not acknowledging %u",
+             packet.GetId());
+  }
 
-          auto &usk_on_air = this->mix_effect_[me].usk_on_air;
-          uint16_t state = usk_on_air.IsValid() ? usk_on_air.Get() : 0;
+  // Send ACK
+  if (packet.GetFlags() & 0x1 && (room || !commands)) {
+    this->remote_id_ = packet.GetId();
+    bool should_parse_packet = true;
 
-          state &= ~(0x1 << keyer);
-          state |= (command.GetData<uint8_t *>()[2] << keyer);
+    AtemPacket p = AtemPacket(0x10, packet.GetSessionId(), 12);
+    p.SetAckId(this->remote_id_);
 
-          usk_on_air.Set(this->sqeuence_, state);
-          break;
-        }
-        case ATEM_CMD("MPCE"): {  // Media Player Source
-          event |= 1 << ATEM_EVENT_MEDIA_PLAYER;
-          mediaplayer = command.GetData<uint8_t *>()[0];
-          if (this->media_player_source_.size() <= mediaplayer) break;
-
-          const MediaPlayerSource source = {
-              .type = command.GetData(1),
-              .still_index = command.GetData(2),
-              .clip_index = command.GetData(3),
-          };
-          this->media_player_source_[mediaplayer].Set(this->sqeuence_, source);
-          break;
-        }
-        case ATEM_CMD("MPfe"): {  // Media Pool Frame Description
-          uint8_t type = command.GetData<uint8_t *>()[0];
-          uint16_t index = command.GetDataS<uint16_t>(1);
-          bool is_used = command.GetData<uint8_t *>()[4];
-
-          if (type != 0) break;  // Only work with stills
-          event |= 1 << ATEM_EVENT_MEDIA_POOL;
-
-          // Clear index
-          auto it = this->media_player_file_.find(index);
-          if (it != this->media_player_file_.end()) {
-            if ((*it).second.IsValid()) free((*it).second.Get());
-            (*it).second.Set(this->sqeuence_, nullptr);
-          }
-
-          // Store file
-          if (is_used) {
-            // Create a copy of the filename
-            uint8_t filename_len = command.GetData<uint8_t *>()[23];
-            char *filename =
-                strndup(command.GetData<char *>() + 24, filename_len);
-
-            if (it != this->media_player_file_.end()) {
-              (*it).second.Set(this->sqeuence_, filename);
-            } else {
-              AtemState<char *> file;
-              file.Set(this->sqeuence_, filename);
-              media_player_file_.insert({index, file});
-            }
-          }
-          break;
-        }
-        case ATEM_CMD("PrgI"): {  // Program Input
-          event |= 1 << ATEM_EVENT_SOURCE;
-          me = command.GetData<uint8_t *>()[0];
-
-          if (this->mix_effect_.size() <= me) break;
-          this->mix_effect_[me].program.Set(this->sqeuence_,
-                                            command.GetDataS<Source>(1));
-          break;
-        }
-        case ATEM_CMD("PrvI"): {  // Preview Input
-          event |= 1 << ATEM_EVENT_SOURCE;
-          me = command.GetData<uint8_t *>()[0];
-
-          if (this->mix_effect_.size() <= me) break;
-          this->mix_effect_[me].preview.Set(this->sqeuence_,
-                                            command.GetDataS<Source>(1));
-          break;
-        }
-        case ATEM_CMD("StRS"): {  // Stream Status
-          if (command.GetLength() != 12) continue;
-          event |= 1 << ATEM_EVENT_STREAM;
-          this->stream_.Set(this->sqeuence_,
-                            (StreamState)(command.GetData<uint8_t *>()[1]));
-          break;
+    if (!this->sqeuence_.Add(packet.GetId())) {
+      ESP_LOGD(TAG, "Received duplicate packet with id %u", packet.GetId());
+      should_parse_packet = false;  // We can ignore this packet
+    }
+
+    // Check if we are receiving it in order
+    const int16_t missing_id = this->sqeuence_.GetMissing();
+    if (missing_id >= 0) {
+      ESP_LOGW(TAG, "Missing packet %u, trying to request it", missing_id);
+
+      // Request missing
+      p.SetFlags(p.GetFlags() | 0x8);
+      p.SetResendId(missing_id);
+      p.SetId(0);
+      p.SetUnknown(0x100);
+    }
+
+#if CONFIG_ATEM_DELAYED_ACK
+    if (missing_id >= 0) {
+      // Never acknowledge the packets after the missing one
+      p.SetAckId(this->sqeuence_.GetLastInOrder());
+      this->SendPacket_(&p);
+    } else if (state_ == ConnectionState::kActive &&
+               this->ack_pending_++ == 0) {
+      this->ack_time_ = esp_timer_get_time();
+    }
+#else
+    if (state_ == ConnectionState::kActive || missing_id >= 0) {
+      this->SendPacket_(&p);
+    }
+#endif
+
+    if (!should_parse_packet) return false;
+  }
+
+#if CONFIG_ATEM_STORE_SEND
+  // Receive ACK
+  if (packet.GetFlags() & 0x10 && this->state_ == ConnectionState::kActive) {
+    AckResult done[kMaxAckResults];
+    size_t done_count = 0;
+
+    if (xSemaphoreTake(this->send_mutex_, 50 / portTICK_PERIOD_MS)) {
+      // An ACK acknowledges all packets up to and including its id, an ACK
+      // older than the last one is ignored
+      const int16_t id = packet.GetAckId();
+      uint16_t count = (id - this->send_acked_id_) & 0x7FFF;
+
+      if (count < 0x4000) {
+        if (count > CONFIG_ATEM_STORE_SEND_SIZE)
+          count = CONFIG_ATEM_STORE_SEND_SIZE;
+
+        // Only the packet with the same id as the ACK can be measured
+        const int64_t now = esp_timer_get_time();
+        const SendInfo &info =
+            this->send_info_[id & (CONFIG_ATEM_STORE_SEND_SIZE - 1)];
+        if (count != 0 && this->GetSendPacket_(id) != nullptr &&
+            !info.retransmitted) {
+          this->UpdateRtt_(now - info.last);
         }
-        case ATEM_CMD("TrPs"): {  // Transition Position
-          event |= 1 << ATEM_EVENT_TRANSITION_POSITION;
-
-          me = command.GetData(0);
-          if (this->mix_effect_.size() <= me) break;
-
-          const TransitionPosition position = {
-              .in_transition = (bool)(command.GetData(1) & 0x01),
-              .position = command.GetDataS<uint16_t>(2),
-          };
-          this->mix_effect_[me].transition.position.Set(this->sqeuence_,
-                                                        position);
-          break;
+
+        for (uint16_t i = 0; i < count; i++) {
+          const int16_t acked = (id - i) & 0x7FFF;
+          AtemPacket *p = this->GetSendPacket_(acked);
+          if (p == nullptr) continue;
+
+          this->tx_.inflight_packets--;
+          this->tx_.inflight_bytes -= p->GetLength();
+          *p = AtemPacket();
+          this->TakeCallbacks_(acked & (CONFIG_ATEM_STORE_SEND_SIZE - 1),
+                               ESP_OK, now, done, done_count);
         }
-        case ATEM_CMD("TrSS"): {  // Transition State
-          event |= 1 << ATEM_EVENT_TRANSITION_STATE;
-
-          me = command.GetData(0);
-          if (this->mix_effect_.size() <= me) break;
-
-          const TransitionState state = {
-              .style = command.GetData(1),
-              .next = command.GetData(2),
-          };
-          this->mix_effect_[me].transition.state.Set(this->sqeuence_, state);
-          break;
+
+        this->send_acked_id_ = id;
+
+        // Restart the timer for the packets that are still outstanding
+        if (count != 0) {
+          if (id == this->local_id_.load(std::memory_order_relaxed))
+            xTimerStop(this->rto_timer_, 0);
+          else
+            this->StartRtoTimer_();
+
+          // There is room in the send window
+          xTaskNotifyGive(this->tx_task_handle_);
         }
       }
+
+      xSemaphoreGive(this->send_mutex_);
+    } else {
+      ESP_LOGW(TAG, "Failed to note of ACK");
     }
 
-    xSemaphoreGive(this->state_mutex_);  // unlock the access
+    for (size_t i = 0; i < done_count; i++) {
+      done[i].callback(done[i].result, done[i].latency, done[i].arg);
+    }
+  }
+#endif
 
-    // Send events
-    if (event != 0 && this->state_ == ConnectionState::kActive) {
-      uint16_t packet_id = packet.GetId();
+  return commands && room;
+}
 
-      for (int32_t i = 0; i < sizeof(event) * 8; i++)
-        if (event & 1 << i)
-          ESP_ERROR_CHECK_WITHOUT_ABORT(
-              esp_event_post(ATEM_EVENT, i, &packet_id, sizeof(packet_id), 0));
-    } else {
-      boot_events |= event;
+void Atem::ParsePacket_(AtemPacket &packet, parser::Context &context) {
+  for (int i = 0; AtemCommand command : packet) {
+    if (++i > 512) {  // Limit 512 command in a single packet
+      ESP_LOGE(TAG, "To many commands in one package");
+      break;
     }
+
+    const uint32_t cmd = ATEM_CMD(((char *)command.GetCmd()));
+    parser::Handler handler = parser::FindHandler(cmd);
+    if (handler != nullptr) handler(context, command);
+    if (this->hook_count_ != 0) this->RunCommandHooks_(cmd, command);
   }
+}
 
-  vTaskDelete(nullptr);
-}  // namespace atem
+void Atem::RunCommandHooks_(uint32_t cmd, AtemCommand &command) {
+  CommandHookEntry *it = std::lower_bound(
+      this->hooks_, this->hooks_ + this->hook_count_, cmd,
+      [](const CommandHookEntry &entry, uint32_t cmd) {
+        return entry.cmd < cmd;
+      });
+
+  for (; it != this->hooks_ + this->hook_count_ && it->cmd == cmd; ++it) {
+    it->hook(command, it->arg);
+  }
+}
+
+void Atem::SwapInState_(int16_t id) {
+  this->time_to_ready_ = xTaskGetTickCount() - this->init_tick_;
+  ESP_LOGI(TAG, "Received initial state in %lu ms",
+           (unsigned long)pdTICKS_TO_MS(this->time_to_ready_));
+
+  // Moving the containers only swaps their pointers
+  xSemaphoreTake(this->state_mutex_, portMAX_DELAY);
+  std::swap(this->switcher_, this->staging_);
+  this->PublishSnapshot_(id);
+  this->journal_.Clear();
+  xSemaphoreGive(this->state_mutex_);
+
+  // Free the previous state outside of the lock
+  this->staging_.Reset();
+  this->state_ready_.store(true, std::memory_order_release);
+
+  // Everything has changed
+  AtemEventData data = {uint16_t(id), UINT64_MAX};
+  for (int32_t i = 0; i <= ATEM_EVENT_TRANSITION_STATE; i++)
+    ESP_ERROR_CHECK_WITHOUT_ABORT(
+        esp_event_post(ATEM_EVENT, i, &data, sizeof(data), 0));
+}
+
+void Atem::PublishSnapshot_(int16_t id) {
+  StateSnapshot snapshot{};
+  this->switcher_.TakeSnapshot(snapshot);
+  snapshot.packet_id = id;
+  this->snapshot_.Write(snapshot);
+}
 
 // MARK Public functions
 
 esp_err_t Atem::SendCommands(const std::vector<AtemCommand *> &commands) {
+  return this->SendCommandList_(commands, nullptr, nullptr);
+}
+
+#if CONFIG_ATEM_STORE_SEND
+esp_err_t Atem::SendCommands(AckCallback callback, void *arg,
+                             const std::vector<AtemCommand *> &commands) {
+  return this->SendCommandList_(commands, callback, arg);
+}
+#endif
+
+esp_err_t Atem::SendCommandList_(const std::vector<AtemCommand *> &commands,
+                                 AckCallback callback, void *arg) {
   // Get the length of the commands
   uint16_t length = 12;  // Packet header
   uint16_t amount = 0;
@@ -693,55 +752,374 @@ esp_err_t Atem::SendCommands(const std::vector<AtemCommand *> &commands) {
   ESP_LOGD(TAG, "Sending %u commands (%u bytes)", amount, length);
 
   // Create the packet
-  AtemPacket *packet = new AtemPacket(0x1, this->session_id_, length);
-  packet->SetId(++this->local_id_);
+  AtemPacket packet(0x1, this->session_id_, length);
+  if (unlikely(packet.GetData() == nullptr)) return ESP_ERR_NO_MEM;
 
   // Copy commands into packet
   uint16_t i = 12;
   for (auto c : commands) {
     if (unlikely(c == nullptr)) continue;
-    c->PrepairCommand(this->version_.Get());
-    memcpy((uint8_t *)packet->GetData() + i, c->GetRawData(), c->GetLength());
+    c->PrepairCommand(this->switcher_.version.Get());
+    memcpy((uint8_t *)packet.GetData() + i, c->GetRawData(), c->GetLength());
     i += c->GetLength();
     delete c;
   }
 
-  if (unlikely(i != length)) {
-    delete packet;
-    return ESP_FAIL;
+  if (unlikely(i != length)) return ESP_FAIL;
+
+  return this->QueuePacket_(std::move(packet), callback, arg);
+}
+
+esp_err_t Atem::QueuePacket_(AtemPacket &&packet, AckCallback callback,
+                             void *arg, TickType_t wait) {
+  const TxItem item = {packet.Detach(), callback, arg};
+  if (!xQueueSend(this->tx_queue_, &item, wait)) {
+    AtemPacket::Adopt(item.data);  // Give the buffer back
+#if CONFIG_ATEM_STORE_SEND
+    this->queue_full_.fetch_add(1, std::memory_order_relaxed);
+#endif
+    ESP_LOGW(TAG, "Transmit queue is full, dropping packet");
+    return ESP_ERR_NO_MEM;
   }
 
-  // Send the packet
-  if (this->SendPacket_(packet) != ESP_OK) {
-    delete packet;
-    return ESP_FAIL;
+  return ESP_OK;
+}
+
+esp_err_t Atem::QueueCommand(AtemCommand &&command) {
+  const uint16_t length = command.GetLength();
+  if (length > kMaxCoalesceLength) return ESP_ERR_INVALID_SIZE;
+
+  command.PrepairCommand(this->switcher_.version.Get());
+  const char *name = (const char *)command.GetRawData() + 4;
+  const uint32_t cmd = ATEM_CMD(name);
+  const uint32_t key = command.GetCoalesceKey();
+
+  xSemaphoreTake(this->coalesce_mutex_, portMAX_DELAY);
+  CoalesceEntry *end = this->coalesce_ + this->coalesce_count_;
+  CoalesceEntry *entry = end;
+  if (key != AtemCommand::kUnique) {
+    entry = std::find_if(this->coalesce_, end, [&](const CoalesceEntry &e) {
+      return e.cmd == cmd && e.key == key;
+    });
   }
 
-#if CONFIG_ATEM_STORE_SEND
-  // Store packet in send_packets_
-  if (xSemaphoreTake(this->send_mutex_, pdMS_TO_TICKS(10))) {
-    if (this->send_packets_.size() >= 32) {
-      AtemPacket *p = this->send_packets_.back();
-      this->send_packets_.pop_back();
-      delete p;
+  // Add a new command to the queue
+  if (entry == end) {
+    if (this->coalesce_count_ >= CONFIG_ATEM_COALESCE_SLOTS) {
+      xSemaphoreGive(this->coalesce_mutex_);
+      return ESP_ERR_NO_MEM;
     }
 
-    this->send_packets_.push_back(packet);
-    xSemaphoreGive(this->send_mutex_);
-    return ESP_OK;
+    entry->cmd = cmd;
+    entry->key = key;
+    this->coalesce_count_++;
   }
 
-  ESP_LOGW(TAG, "Failed to store packet (MUTEX FAIL)");
-  delete packet;
-  return ESP_ERR_TIMEOUT;
-#else
-  delete packet;
+  memcpy(entry->data, command.GetRawData(), length);
+  const bool first = this->coalesce_count_ == 1 && entry == end;
+  xSemaphoreGive(this->coalesce_mutex_);
+
+  // The queue is send once the timer expires
+  if (first) xTimerStart(this->coalesce_timer_, 0);
+  return ESP_OK;
+}
+
+esp_err_t Atem::RegisterCommandHook(const char *cmd, CommandHook hook,
+                                    void *arg) {
+  if (cmd == nullptr || strlen(cmd) != 4 || hook == nullptr)
+    return ESP_ERR_INVALID_ARG;
+
+  xSemaphoreTake(this->hook_mutex_, portMAX_DELAY);
+  if (this->hook_count_ >= CONFIG_ATEM_COMMAND_HOOKS) {
+    xSemaphoreGive(this->hook_mutex_);
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Insert the hook after all hooks with the same cmd
+  const CommandHookEntry entry = {
+      .cmd = ATEM_CMD(cmd),
+      .hook = hook,
+      .arg = arg,
+  };
+  CommandHookEntry *it = std::upper_bound(
+      this->hooks_, this->hooks_ + this->hook_count_, entry.cmd,
+      [](uint32_t cmd, const CommandHookEntry &entry) {
+        return cmd < entry.cmd;
+      });
+  std::move_backward(it, this->hooks_ + this->hook_count_,
+                     this->hooks_ + this->hook_count_ + 1);
+  *it = entry;
+  this->hook_count_++;
+
+  xSemaphoreGive(this->hook_mutex_);
+  return ESP_OK;
+}
+
+esp_err_t Atem::UnregisterCommandHook(const char *cmd, CommandHook hook,
+                                      void *arg) {
+  if (cmd == nullptr || strlen(cmd) != 4) return ESP_ERR_INVALID_ARG;
+
+  xSemaphoreTake(this->hook_mutex_, portMAX_DELAY);
+  CommandHookEntry *end = this->hooks_ + this->hook_count_;
+  CommandHookEntry *it = std::find_if(
+      this->hooks_, end, [&](const CommandHookEntry &entry) {
+        return entry.cmd == ATEM_CMD(cmd) && entry.hook == hook &&
+               entry.arg == arg;
+      });
+
+  if (it == end) {
+    xSemaphoreGive(this->hook_mutex_);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  std::move(it + 1, end, it);
+  this->hook_count_--;
+
+  xSemaphoreGive(this->hook_mutex_);
   return ESP_OK;
-#endif
 }
 
 // MARK: Private functions
 
+void Atem::FlushCoalesced_() {
+  // Don't block the timer task, try again later
+  if (!xSemaphoreTake(this->coalesce_mutex_, 0)) {
+    xTimerStart(this->coalesce_timer_, 0);
+    return;
+  }
+
+  for (size_t i = 0; i < this->coalesce_count_;) {
+    // Put as many commands in a packet as possible
+    uint16_t length = 12;  // Packet header
+    size_t end = i;
+    for (; end < this->coalesce_count_; end++) {
+      const AtemCommand command(this->coalesce_[end].data);
+      if (length + command.GetLength() > CONFIG_PACKET_BUFFER_SIZE) break;
+      length += command.GetLength();
+    }
+
+    AtemPacket packet(0x1, this->session_id_, length);
+    if (unlikely(packet.GetData() == nullptr)) break;
+
+    uint8_t *data = (uint8_t *)packet.GetData() + 12;
+    for (; i < end; i++) {
+      const AtemCommand command(this->coalesce_[i].data);
+      memcpy(data, command.GetRawData(), command.GetLength());
+      data += command.GetLength();
+    }
+
+    // Don't block the timer task
+    ESP_ERROR_CHECK_WITHOUT_ABORT(
+        this->QueuePacket_(std::move(packet), nullptr, nullptr, 0));
+  }
+
+  this->coalesce_count_ = 0;
+  xSemaphoreGive(this->coalesce_mutex_);
+}
+
+#if CONFIG_ATEM_STORE_SEND
+esp_err_t Atem::SendStoredPacket_(AtemPacket &&packet,
+                                  const AckTarget *callbacks, size_t count) {
+  // Store the packet before sending it, so the ACK can't arrive before that
+  xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
+
+  const uint16_t id = this->NextLocalId_();
+  packet.SetId(id);
+
+  // This replaces the oldest packet in the ring
+  const int64_t now = esp_timer_get_time();
+  const size_t slot = id & (CONFIG_ATEM_STORE_SEND_SIZE - 1);
+  AtemPacket &p = this->send_packets_[slot];
+  AckResult dropped[kMaxCallbacks];
+  size_t dropped_count = 0;
+  if (p.GetData() != nullptr) {
+    this->tx_.inflight_packets--;
+    this->tx_.inflight_bytes -= p.GetLength();
+    this->TakeCallbacks_(slot, ESP_FAIL, now, dropped, dropped_count);
+  }
+
+  p = std::move(packet);
+  this->tx_.inflight_packets++;
+  this->tx_.inflight_bytes += p.GetLength();
+  // When sending fails the packet is send again after the timeout
+  SendInfo &info = this->send_info_[slot];
+  info = {now, now, false, (uint8_t)count, {}};
+  std::copy_n(callbacks, count, info.callbacks);
+  const esp_err_t ret = this->SendPacket_(&p);
+
+  // The timer is already running for an older packet
+  if (!xTimerIsTimerActive(this->rto_timer_)) this->StartRtoTimer_();
+
+  xSemaphoreGive(this->send_mutex_);
+
+  for (size_t i = 0; i < dropped_count; i++) {
+    dropped[i].callback(dropped[i].result, dropped[i].latency, dropped[i].arg);
+  }
+  return ret;
+}
+#else
+esp_err_t Atem::SendStoredPacket_(AtemPacket &&packet) {
+  packet.SetId(this->NextLocalId_());
+  return this->SendPacket_(&packet);
+}
+#endif
+
+#if CONFIG_ATEM_STORE_SEND
+void Atem::ClearSendPackets_() {
+  AckResult done[kMaxAckResults];
+  size_t done_count = 0;
+  const int64_t now = esp_timer_get_time();
+
+  xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
+  for (size_t i = 0; i < CONFIG_ATEM_STORE_SEND_SIZE; i++) {
+    if (this->send_packets_[i].GetData() != nullptr)
+      this->TakeCallbacks_(i, ESP_ERR_INVALID_STATE, now, done, done_count);
+    this->send_packets_[i] = AtemPacket();
+  }
+  this->send_acked_id_ = 0;
+  this->rtt_ = {0, 0, CONFIG_ATEM_RTO_MAX * 1000, 0, 0};
+  this->tx_.inflight_packets = 0;
+  this->tx_.inflight_bytes = 0;
+  xTimerStop(this->rto_timer_, 0);
+  xSemaphoreGive(this->send_mutex_);
+
+  for (size_t i = 0; i < done_count; i++) {
+    done[i].callback(done[i].result, done[i].latency, done[i].arg);
+  }
+}
+
+Atem::TxStats Atem::GetTxStats() const {
+  xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
+  TxStats stats = this->tx_;
+  xSemaphoreGive(this->send_mutex_);
+
+  stats.queue_full = this->queue_full_.load(std::memory_order_relaxed);
+  stats.queued = uxQueueMessagesWaiting(this->tx_queue_);
+  return stats;
+}
+
+void Atem::WaitForWindow_(uint16_t length) {
+  bool waited = false;
+
+  for (;;) {
+    xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
+    const TxStats &tx = this->tx_;
+    const bool full =
+        tx.inflight_packets >= CONFIG_ATEM_TX_WINDOW_PACKETS ||
+        (tx.inflight_packets != 0 &&
+         tx.inflight_bytes + length > CONFIG_ATEM_TX_WINDOW_BYTES);
+    if (full && !waited) this->tx_.window_full++;
+    xSemaphoreGive(this->send_mutex_);
+
+    if (!full) return;
+    waited = true;
+
+    // Woken up by an ACK, the timeout handles a reset of the connection
+    ulTaskNotifyTake(pdTRUE, std::max<TickType_t>(1, pdMS_TO_TICKS(10)));
+  }
+}
+
+void Atem::TakeCallbacks_(size_t slot, esp_err_t result, int64_t now,
+                          AckResult *out, size_t &count) {
+  SendInfo &info = this->send_info_[slot];
+  const uint32_t latency = now - info.first;
+
+  for (size_t i = 0; i < info.callback_count; i++) {
+    out[count++] = {info.callbacks[i].callback, info.callbacks[i].arg, result,
+                    latency};
+  }
+  info.callback_count = 0;
+}
+
+void Atem::AckWaitCallback_(esp_err_t result, uint32_t latency, void *arg) {
+  AckWait *wait = (AckWait *)arg;
+  wait->result = result;
+  wait->latency = latency;
+  xSemaphoreGive(wait->done);
+}
+
+Atem::RttStats Atem::GetRttStats() const {
+  xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
+  const RttStats stats = this->rtt_;
+  xSemaphoreGive(this->send_mutex_);
+  return stats;
+}
+
+void Atem::UpdateRtt_(uint32_t rtt) {
+  RttStats &s = this->rtt_;
+
+  if (s.samples++ == 0) {
+    s.srtt = rtt;
+    s.rttvar = rtt / 2;
+  } else {
+    const uint32_t delta = s.srtt > rtt ? s.srtt - rtt : rtt - s.srtt;
+    s.rttvar = (3 * s.rttvar + delta) / 4;
+    s.srtt = (7 * s.srtt + rtt) / 8;
+  }
+
+  // Also resets the back off of RetransmitExpired_
+  s.rto = std::clamp<uint32_t>(s.srtt + 4 * s.rttvar,
+                               CONFIG_ATEM_RTO_MIN * 1000,
+                               CONFIG_ATEM_RTO_MAX * 1000);
+}
+
+void Atem::StartRtoTimer_() {
+  const TickType_t ticks = pdMS_TO_TICKS(this->rtt_.rto / 1000);
+  xTimerChangePeriod(this->rto_timer_, std::max<TickType_t>(1, ticks), 0);
+}
+
+void Atem::RetransmitExpired_() {
+  // Don't block the timer task, try again later
+  if (!xSemaphoreTake(this->send_mutex_, 0)) {
+    xTimerStart(this->rto_timer_, 0);
+    return;
+  }
+
+  const int64_t now = esp_timer_get_time();
+  const bool active = this->state_ == ConnectionState::kActive;
+  bool outstanding = false, resend = false;
+  AckResult done[kMaxAckResults];
+  size_t done_count = 0;
+
+  // Send the packets in order, starting with the oldest one
+  for (int i = 1; i <= CONFIG_ATEM_STORE_SEND_SIZE; i++) {
+    const int16_t id = (this->send_acked_id_ + i) & 0x7FFF;
+    AtemPacket *p = this->GetSendPacket_(id);
+    if (p == nullptr) continue;
+
+    const size_t slot = id & (CONFIG_ATEM_STORE_SEND_SIZE - 1);
+    SendInfo &info = this->send_info_[slot];
+    outstanding = true;
+
+    // Give up waiting, the packet is still send again
+    if (now - info.first >= CONFIG_ATEM_ACK_TIMEOUT * 1000)
+      this->TakeCallbacks_(slot, ESP_ERR_TIMEOUT, now, done, done_count);
+
+    if (!active || now - info.last < this->rtt_.rto) continue;
+
+    ESP_LOGD(TAG, "No ACK for %u, sending it again", id);
+    this->SendPacket_(p);
+    info.last = now;
+    info.retransmitted = true;
+    this->rtt_.retransmits++;
+    resend = true;
+  }
+
+  // Back off until a new measurement is made
+  if (resend) {
+    this->rtt_.rto =
+        std::min<uint32_t>(this->rtt_.rto * 2, CONFIG_ATEM_RTO_MAX * 1000);
+  }
+
+  if (outstanding) this->StartRtoTimer_();
+  xSemaphoreGive(this->send_mutex_);
+
+  for (size_t i = 0; i < done_count; i++) {
+    done[i].callback(done[i].result, done[i].latency, done[i].arg);
+  }
+}
+#endif
+
 esp_err_t Atem::SendPacket_(AtemPacket *packet) {
   ESP_LOG_BUFFER_HEXDUMP(TAG, packet->GetData(), packet->GetLength(),
                          ESP_LOG_VERBOSE);
@@ -759,55 +1137,55 @@ esp_err_t Atem::SendPacket_(AtemPacket *packet) {
   return ESP_OK;
 }
 
+#if CONFIG_ATEM_DELAYED_ACK
+void Atem::SendAck_() {
+  AtemPacket p = AtemPacket(0x10, this->session_id_, 12);
+  p.SetAckId(this->sqeuence_.GetLastInOrder());
+  this->SendPacket_(&p);
+  this->ack_pending_ = 0;
+}
+#endif
+
 void Atem::Reconnect_() {
-  const bool was_connected = this->product_id_[0] != '\0';
+  const bool was_connected = this->switcher_.product_id[0] != '\0';
   if (was_connected) ESP_LOGI(TAG, "Reconnecting to ATEM");
 
   // Reset local variables
+  this->state_ready_.store(false, std::memory_order_release);
   this->state_ = ConnectionState::kConnected;
-  this->local_id_ = 0;
+  this->local_id_reset_.store(true, std::memory_order_release);
   this->remote_id_ = 0;
   this->session_id_ = 0x0B06;
   this->sqeuence_ = SequenceCheck();
+#if CONFIG_ATEM_DELAYED_ACK
+  this->ack_pending_ = 0;
+#endif
 
-  // Clear state
+  // Clear state, the parser task resets the initial state once it sees a
+  // packet of the new connection
+  this->generation_++;
   xSemaphoreTake(this->state_mutex_, portMAX_DELAY);
-  this->input_properties_.clear();
-  this->topology_ = AtemState<Topology>();
-  this->version_ = AtemState<ProtocolVersion>();
-  this->media_player_ = AtemState<MediaPlayer>();
-  memset(this->product_id_, 0, sizeof(this->product_id_));
-  this->mix_effect_.clear();
-  this->dsk_.clear();
-  this->aux_out_.clear();
-  this->media_player_source_.clear();
-  for (auto &file : this->media_player_file_) {
-    if (file.second.IsValid()) {
-      free(file.second.Get());
-    }
-  }
-  this->media_player_file_.clear();
-  this->stream_ = AtemState<StreamState>();
+  this->switcher_.Reset();
+  this->PublishSnapshot_(0);
+  this->journal_.Clear();
   xSemaphoreGive(this->state_mutex_);
 
   // Remove all packets
 #if CONFIG_ATEM_STORE_SEND
-  xSemaphoreTake(this->send_mutex_, portMAX_DELAY);
-  for (auto p : this->send_packets_) delete p;
-  this->send_packets_.clear();
-  xSemaphoreGive(this->send_mutex_);
+  this->ClearSendPackets_();
 #endif
 
   // Send event that Product ID has changed
   if (was_connected) {
-    uint16_t packet_id = 0;
+    AtemEventData data = {0, UINT64_MAX};
     ESP_ERROR_CHECK_WITHOUT_ABORT(esp_event_post(
-        ATEM_EVENT, ATEM_EVENT_PRODUCT_ID, &packet_id, sizeof(packet_id), 0));
+        ATEM_EVENT, ATEM_EVENT_PRODUCT_ID, &data, sizeof(data), 0));
   }
 
   // Send init request
   AtemPacket p = AtemPacket(0x2, this->session_id_, 20);
   ((uint8_t *)p.GetData())[12] = 0x01;
+  this->init_tick_ = xTaskGetTickCount();
   this->SendPacket_(&p);
 }
 
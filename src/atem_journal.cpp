@@ -0,0 +1,44 @@
+#include "atem_journal.h"
+
+#include <algorithm>
+
+namespace atem {
+
+static constexpr uint32_t kSize = CONFIG_ATEM_CHANGE_JOURNAL_SIZE;
+
+void ChangeJournal::Add(const Change &change) {
+  portENTER_CRITICAL(&this->mux_);
+  this->changes_[this->head_ % kSize] = change;
+  this->head_++;
+  portEXIT_CRITICAL(&this->mux_);
+}
+
+void ChangeJournal::Clear() {
+  portENTER_CRITICAL(&this->mux_);
+  // Skip a sequence, so a reader that has read all changes is behind as well
+  this->head_++;
+  this->start_ = this->head_;
+  portEXIT_CRITICAL(&this->mux_);
+}
+
+size_t ChangeJournal::GetChangesSince(uint32_t &cursor, Change *changes,
+                                      size_t length, bool &behind) {
+  portENTER_CRITICAL(&this->mux_);
+
+  // The oldest change that's still in the ring
+  const uint32_t oldest =
+      std::max(this->start_, this->head_ > kSize ? this->head_ - kSize : 0);
+  behind = cursor < oldest || cursor > this->head_;
+  if (behind) cursor = oldest;
+
+  const size_t n = std::min<size_t>(length, this->head_ - cursor);
+  for (size_t i = 0; i < n; i++) {
+    changes[i] = this->changes_[(cursor + i) % kSize];
+  }
+  cursor += n;
+
+  portEXIT_CRITICAL(&this->mux_);
+  return n;
+}
+
+}  // namespace atem
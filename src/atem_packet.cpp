@@ -1,10 +1,78 @@
 #include "atem_packet.h"
 
+#include <esp_compiler.h>
+
+#include <numeric>
+
 namespace atem {
 
+// MARK: PacketPool
+
+alignas(4) uint8_t
+    PacketPool::buffers_[kSmallCount * kSmallSize + kLargeCount * kLargeSize];
+uint8_t PacketPool::free_[kSmallCount + kLargeCount] = {};
+size_t PacketPool::small_free_ = 0;
+size_t PacketPool::large_free_ = 0;
+uint32_t PacketPool::exhausted_ = 0;
+portMUX_TYPE PacketPool::mux_ = portMUX_INITIALIZER_UNLOCKED;
+
+static_assert(CONFIG_ATEM_PACKET_POOL_SIZE <= UINT8_MAX + 1,
+              "The index of a buffer must fit in an uint8_t");
+
+void *PacketPool::Acquire(uint16_t length) {
+  const bool small = length <= kSmallSize;
+  if (small || length <= kLargeSize) {
+    static bool initialized = false;
+    void *data = nullptr;
+
+    portENTER_CRITICAL(&mux_);
+    if (unlikely(!initialized)) {
+      std::iota(free_, free_ + kSmallCount, 0);
+      std::iota(free_ + kSmallCount, free_ + kSmallCount + kLargeCount, 0);
+      small_free_ = kSmallCount;
+      large_free_ = kLargeCount;
+      initialized = true;
+    }
+
+    if (small && likely(small_free_ != 0)) {
+      data = buffers_ + free_[--small_free_] * kSmallSize;
+    } else if (!small && large_free_ != 0) {
+      data = buffers_ + kSmallCount * kSmallSize +
+             free_[kSmallCount + --large_free_] * kLargeSize;
+    } else {
+      exhausted_++;
+    }
+    portEXIT_CRITICAL(&mux_);
+
+    if (likely(data != nullptr)) return data;
+  }
+
+  return malloc(length);
+}
+
+void PacketPool::Release(void *data) {
+  const uint8_t *p = (const uint8_t *)data;
+  const uint8_t *large = buffers_ + kSmallCount * kSmallSize;
+  if (p < buffers_ || p >= buffers_ + sizeof(buffers_)) {
+    free(data);
+    return;
+  }
+
+  portENTER_CRITICAL(&mux_);
+  if (p < large) {
+    free_[small_free_++] = (p - buffers_) / kSmallSize;
+  } else {
+    free_[kSmallCount + large_free_++] = (p - large) / kLargeSize;
+  }
+  portEXIT_CRITICAL(&mux_);
+}
+
+// MARK: AtemPacket
+
 AtemPacket::AtemPacket(uint8_t flags, uint16_t session, uint16_t length) {
   if (length < 12) length = 12;  // Cap minimal size
-  this->data_ = malloc(length);
+  this->data_ = PacketPool::Acquire(length);
+  if (unlikely(this->data_ == nullptr)) return;
 
   // Clean the header, the rest is for the consumer
   memset(this->data_, 0x0, 12);
@@ -15,7 +83,7 @@ AtemPacket::AtemPacket(uint8_t flags, uint16_t session, uint16_t length) {
 }
 
 AtemPacket::~AtemPacket() {
-  if (this->has_alloc_) free(this->data_);
+  if (this->has_alloc_) PacketPool::Release(this->data_);
 }
 
 }  // namespace atem
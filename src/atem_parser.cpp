@@ -0,0 +1,529 @@
+#include "atem_parser.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "atem.h"
+
+namespace atem {
+
+void SwitcherState::Reset() { *this = SwitcherState(); }
+
+template <typename T>
+static void CopyValue(StateSnapshot::Value<T> &value,
+                      const AtemState<T> &state) {
+  value.valid = state.IsValid();
+  value.value = state.Get();
+}
+
+void SwitcherState::TakeSnapshot(StateSnapshot &snapshot) const {
+  snapshot.connected = this->product_id[0] != '\0';
+  memcpy(snapshot.product_id, this->product_id, sizeof(snapshot.product_id));
+  CopyValue(snapshot.version, this->version);
+  CopyValue(snapshot.topology, this->topology);
+  CopyValue(snapshot.media_player, this->media_player);
+  CopyValue(snapshot.stream, this->stream);
+
+  snapshot.me_count =
+      std::min<size_t>(this->mix_effect.size(), StateSnapshot::kMaxMe);
+  for (uint8_t i = 0; i < snapshot.me_count; i++) {
+    const MixEffect &me = this->mix_effect[i];
+    StateSnapshot::Me &s = snapshot.me[i];
+    CopyValue(s.program, me.program);
+    CopyValue(s.preview, me.preview);
+    CopyValue(s.usk_on_air, me.usk_on_air);
+    CopyValue(s.transition_state, me.transition.state);
+    CopyValue(s.transition_position, me.transition.position);
+    CopyValue(s.ftb, me.ftb);
+  }
+
+  snapshot.dsk_count =
+      std::min<size_t>(this->dsk.size(), StateSnapshot::kMaxDsk);
+  for (uint8_t i = 0; i < snapshot.dsk_count; i++) {
+    CopyValue(snapshot.dsk[i].state, this->dsk[i].state);
+    CopyValue(snapshot.dsk[i].source, this->dsk[i].source);
+  }
+
+  snapshot.aux_count =
+      std::min<size_t>(this->aux_out.size(), StateSnapshot::kMaxAux);
+  for (uint8_t i = 0; i < snapshot.aux_count; i++) {
+    CopyValue(snapshot.aux[i], this->aux_out[i]);
+  }
+
+  snapshot.media_player_count = std::min<size_t>(
+      this->media_player_source.size(), StateSnapshot::kMaxMediaPlayers);
+  for (uint8_t i = 0; i < snapshot.media_player_count; i++) {
+    CopyValue(snapshot.media_player_source[i], this->media_player_source[i]);
+  }
+}
+
+namespace parser {
+
+// MARK: Handlers
+
+// Get the event of a field and the bit of the index in AtemEventData::dirty
+static int32_t GetDirtyBit(ChangeField field, uint16_t index, uint8_t sub,
+                           uint16_t &bit) {
+  bit = index;
+  switch (field) {
+    case ChangeField::kAux:
+      return ATEM_EVENT_AUX;
+    case ChangeField::kDskSource:
+    case ChangeField::kDskProperties:
+    case ChangeField::kDskState:
+      return ATEM_EVENT_DSK;
+    case ChangeField::kFadeToBlack:
+      return ATEM_EVENT_FADE_TO_BLACK;
+    case ChangeField::kUskState:
+    case ChangeField::kUskAtKeyFrame:
+    case ChangeField::kUskOnAir:
+      bit = index * 16 + sub;
+      return ATEM_EVENT_USK;
+    case ChangeField::kUskDve:
+      bit = index * 16 + sub;
+      return ATEM_EVENT_USK_DVE;
+    case ChangeField::kMediaPlayerSource:
+      return ATEM_EVENT_MEDIA_PLAYER;
+    case ChangeField::kMediaPoolFile:
+      return ATEM_EVENT_MEDIA_POOL;
+    case ChangeField::kProgram:
+    case ChangeField::kPreview:
+      return ATEM_EVENT_SOURCE;
+    case ChangeField::kTransitionPosition:
+      return ATEM_EVENT_TRANSITION_POSITION;
+    case ChangeField::kTransitionState:
+      return ATEM_EVENT_TRANSITION_STATE;
+    default:
+      break;
+  }
+
+  // The field doesn't have an index
+  bit = UINT16_MAX;
+  switch (field) {
+    case ChangeField::kProtocolVersion:
+      return ATEM_EVENT_PROTOCOL_VERSION;
+    case ChangeField::kProductId:
+      return ATEM_EVENT_PRODUCT_ID;
+    case ChangeField::kTopology:
+      return ATEM_EVENT_TOPOLOGY;
+    case ChangeField::kMediaPlayer:
+      return ATEM_EVENT_MEDIA_PLAYER;
+    case ChangeField::kInputProperty:
+      return ATEM_EVENT_INPUT_PROPERTIES;
+    case ChangeField::kStream:
+    default:
+      return ATEM_EVENT_STREAM;
+  }
+}
+
+// Mark a field as dirty and add it to the journal, the initial state isn't
+// journaled
+static inline void Changed(Context &ctx, ChangeField field, uint16_t index = 0,
+                           uint8_t sub = 0) {
+  uint16_t bit;
+  const int32_t event = GetDirtyBit(field, index, sub, bit);
+  ctx.dirty[event] |= bit < 64 ? uint64_t(1) << bit : UINT64_MAX;
+
+  if (ctx.journal != nullptr)
+    ctx.journal->Add({uint16_t(ctx.id), field, sub, index});
+}
+
+// _mpl
+static void ParseMediaPlayerConfig(Context &ctx, AtemCommand &command) {
+  MediaPlayer media_player;
+  if (!layout::MediaPlayer::Decode(command, media_player.still,
+                                   media_player.clip))
+    return;
+
+  ctx.event |= 1 << ATEM_EVENT_MEDIA_PLAYER;
+  if (ctx.state.media_player.Set(ctx.id, media_player))
+    Changed(ctx, ChangeField::kMediaPlayer);
+
+  // Allocate the file names of all stills at once
+  ctx.state.media_player_file.Reserve(media_player.still);
+}
+
+// _MeC
+static void ParseMixEffectConfig(Context &ctx, AtemCommand &command) {
+  uint8_t me, num_keyer;
+  if (!layout::MixEffectConfig::Decode(command, me, num_keyer)) return;
+  ctx.event |= 1 << ATEM_EVENT_TOPOLOGY;
+
+  if (ctx.state.mix_effect.size() <= me) return;
+  ctx.state.mix_effect[me].keyer.resize(num_keyer);
+  Changed(ctx, ChangeField::kTopology, me);
+}
+
+// _ver
+static void ParseProtocolVersion(Context &ctx, AtemCommand &command) {
+  ProtocolVersion version;
+  if (!layout::ProtocolVersion::Decode(command, version.major, version.minor))
+    return;
+
+  ctx.event |= 1 << ATEM_EVENT_PROTOCOL_VERSION;
+  if (ctx.state.version.Set(ctx.id, version))
+    Changed(ctx, ChangeField::kProtocolVersion);
+}
+
+// _pin
+static void ParseProductId(Context &ctx, AtemCommand &command) {
+  const char *name;
+  if (!layout::ProductId::Decode(command, name)) return;
+  ctx.event |= 1 << ATEM_EVENT_PRODUCT_ID;
+
+  char *product_id = ctx.state.product_id;
+  size_t len = strnlen(name, sizeof(ctx.state.product_id) - 1);
+  memcpy(product_id, name, len);
+  memset(product_id + len, 0, sizeof(ctx.state.product_id) - len);
+  Changed(ctx, ChangeField::kProductId);
+}
+
+// _top
+static void ParseTopology(Context &ctx, AtemCommand &command) {
+  Topology top;
+  memset(&top, 0, sizeof(top));
+  if (!layout::Topology::Decode(
+          command, top.me, top.sources, top.dsk, top.aux, top.mixminus_outputs,
+          top.mediaplayers, top.multiviewers, top.rs485, top.hyperdecks,
+          top.dve, top.stingers, top.supersources))
+    return;
+  layout::TopologyExtended::Decode(command, top.talkback_channels,
+                                   top.camera_control);
+
+  ctx.event |= 1 << ATEM_EVENT_TOPOLOGY;
+  if (ctx.state.topology.Set(ctx.id, top))
+    Changed(ctx, ChangeField::kTopology);
+
+  // Resize buffers
+  ctx.state.input_properties.Reserve(top.sources);
+  ctx.state.mix_effect.resize(top.me);
+  ctx.state.dsk.resize(top.dsk);
+  ctx.state.aux_out.resize(top.aux);
+  ctx.state.media_player_source.resize(top.mediaplayers);
+}
+
+// AuxS
+static void ParseAuxSelect(Context &ctx, AtemCommand &command) {
+  uint8_t channel;
+  Source source;
+  if (!layout::AuxSelect::Decode(command, channel, source)) return;
+  ctx.event |= 1 << ATEM_EVENT_AUX;
+
+  if (ctx.state.aux_out.size() <= channel) return;
+  if (ctx.state.aux_out[channel].Set(ctx.id, source))
+    Changed(ctx, ChangeField::kAux, channel);
+}
+
+// DskB
+static void ParseDskSource(Context &ctx, AtemCommand &command) {
+  uint8_t keyer;
+  DskSource source;
+  if (!layout::DskSource::Decode(command, keyer, source.fill, source.key))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_DSK;
+
+  if (ctx.state.dsk.size() <= keyer) return;
+  if (ctx.state.dsk[keyer].source.Set(ctx.id, source))
+    Changed(ctx, ChangeField::kDskSource, keyer);
+}
+
+// DskP
+static void ParseDskProperties(Context &ctx, AtemCommand &command) {
+  uint8_t keyer;
+  DskProperties properties;
+  if (!layout::DskFlag::Decode(command, keyer, properties.tie)) return;
+  ctx.event |= 1 << ATEM_EVENT_DSK;
+
+  if (ctx.state.dsk.size() <= keyer) return;
+  if (ctx.state.dsk[keyer].properties.Set(ctx.id, properties))
+    Changed(ctx, ChangeField::kDskProperties, keyer);
+}
+
+// DskS
+static void ParseDskState(Context &ctx, AtemCommand &command) {
+  uint8_t keyer;
+  DskState state;
+  if (!layout::DskState::Decode(command, keyer, state.on_air,
+                                state.in_transition,
+                                state.is_auto_transitioning))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_DSK;
+
+  if (ctx.state.dsk.size() <= keyer) return;
+  if (ctx.state.dsk[keyer].state.Set(ctx.id, state))
+    Changed(ctx, ChangeField::kDskState, keyer);
+}
+
+// FtbS
+static void ParseFadeToBlackState(Context &ctx, AtemCommand &command) {
+  uint8_t me;
+  FadeToBlack ftb;
+  if (!layout::FadeToBlack::Decode(command, me, ftb.fully_black,
+                                   ftb.in_transition))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_FADE_TO_BLACK;
+
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].ftb.Set(ctx.id, ftb))
+    Changed(ctx, ChangeField::kFadeToBlack, me);
+}
+
+// InPr
+static void ParseInputProperty(Context &ctx, AtemCommand &command) {
+  Source source;
+  const char *name_long, *name_short;
+  if (!layout::InputProperty::Decode(command, source, name_long, name_short))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_INPUT_PROPERTIES;
+
+  InputProperty inpr;
+  memset(&inpr, 0, sizeof(inpr));
+  memcpy(inpr.name_long, name_long,
+         strnlen(name_long, sizeof(inpr.name_long)));
+  memcpy(inpr.name_short, name_short,
+         strnlen(name_short, sizeof(inpr.name_short)));
+
+  if (ctx.state.input_properties.Set(source, ctx.id, inpr))
+    Changed(ctx, ChangeField::kInputProperty, source);
+}
+
+// KeBP
+static void ParseUskProperties(Context &ctx, AtemCommand &command) {
+  uint8_t me, keyer;
+  UskState state;
+  if (!layout::UskProperties::Decode(command, me, keyer, state.type,
+                                     state.fill, state.key, state.top,
+                                     state.bottom, state.left, state.right))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_USK;
+
+  // Check if we have allocated memory for this
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].keyer.size() <= keyer) return;
+
+  if (ctx.state.mix_effect[me].keyer[keyer].state.Set(ctx.id, state))
+    Changed(ctx, ChangeField::kUskState, me, keyer);
+}
+
+// KeDV
+static void ParseUskDveProperties(Context &ctx, AtemCommand &command) {
+  uint8_t me, keyer;
+  DveState properties;
+  if (!layout::UskDve::Decode(command, me, keyer, properties.size_x,
+                              properties.size_y, properties.pos_x,
+                              properties.pos_y, properties.rotation))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_USK_DVE;
+
+  // Check if we have allocated memory for this
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].keyer.size() <= keyer) return;
+
+  if (ctx.state.mix_effect[me].keyer[keyer].dve.Set(ctx.id, properties))
+    Changed(ctx, ChangeField::kUskDve, me, keyer);
+}
+
+// KeFS
+static void ParseUskFlyState(Context &ctx, AtemCommand &command) {
+  uint8_t me, keyer;
+  bool at_key_frame;
+  if (!layout::UskFlyState::Decode(command, me, keyer, at_key_frame)) return;
+  ctx.event |= 1 << ATEM_EVENT_USK;
+
+  // Check if we have allocated memory for this
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].keyer.size() <= keyer) return;
+
+  if (ctx.state.mix_effect[me].keyer[keyer].at_key_frame.Set(ctx.id,
+                                                             at_key_frame))
+    Changed(ctx, ChangeField::kUskAtKeyFrame, me, keyer);
+}
+
+// KeOn
+static void ParseUskOnAir(Context &ctx, AtemCommand &command) {
+  uint8_t me, keyer;
+  bool on_air;
+  if (!layout::UskOnAir::Decode(command, me, keyer, on_air)) return;
+  ctx.event |= 1 << ATEM_EVENT_USK;
+
+  // Check if we have allocated memory for this
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (keyer > 15) return;
+
+  auto &usk_on_air = ctx.state.mix_effect[me].usk_on_air;
+  uint16_t state = usk_on_air.IsValid() ? usk_on_air.Get() : 0;
+
+  state &= ~(0x1 << keyer);
+  state |= (on_air << keyer);
+
+  if (usk_on_air.Set(ctx.id, state))
+    Changed(ctx, ChangeField::kUskOnAir, me, keyer);
+}
+
+// MPCE
+static void ParseMediaPlayerSource(Context &ctx, AtemCommand &command) {
+  uint8_t mediaplayer;
+  MediaPlayerSource source;
+  if (!layout::MediaPlayerSource::Decode(command, mediaplayer, source.type,
+                                         source.still_index,
+                                         source.clip_index))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_MEDIA_PLAYER;
+
+  if (ctx.state.media_player_source.size() <= mediaplayer) return;
+  if (ctx.state.media_player_source[mediaplayer].Set(ctx.id, source))
+    Changed(ctx, ChangeField::kMediaPlayerSource, mediaplayer);
+}
+
+// MPfe
+static void ParseMediaPoolFrame(Context &ctx, AtemCommand &command) {
+  uint8_t type, filename_len;
+  uint16_t index;
+  bool is_used;
+  if (!layout::MediaPoolFrame::Decode(command, type, index, is_used,
+                                      filename_len))
+    return;
+
+  if (type != 0) return;  // Only work with stills
+  ctx.event |= 1 << ATEM_EVENT_MEDIA_POOL;
+
+  // The name directly follows the fields, never read past the command
+  const char *filename = nullptr;
+  if (is_used) {
+    const uint16_t available =
+        command.GetLength() - layout::MediaPoolFrame::kLength;
+    if (filename_len > available) filename_len = available;
+    filename = command.GetData<char *>() + layout::MediaPoolFrame::kLength - 8;
+  }
+
+  // The name may contain a terminator before filename_len
+  if (filename != nullptr) filename_len = strnlen(filename, filename_len);
+  if (ctx.state.media_player_file.Set(index, ctx.id, filename, filename_len))
+    Changed(ctx, ChangeField::kMediaPoolFile, index);
+}
+
+// PrgI
+static void ParseProgramInput(Context &ctx, AtemCommand &command) {
+  uint8_t me;
+  Source source;
+  if (!layout::MeSource::Decode(command, me, source)) return;
+  ctx.event |= 1 << ATEM_EVENT_SOURCE;
+
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].program.Set(ctx.id, source))
+    Changed(ctx, ChangeField::kProgram, me);
+}
+
+// PrvI
+static void ParsePreviewInput(Context &ctx, AtemCommand &command) {
+  uint8_t me;
+  Source source;
+  if (!layout::MeSource::Decode(command, me, source)) return;
+  ctx.event |= 1 << ATEM_EVENT_SOURCE;
+
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].preview.Set(ctx.id, source))
+    Changed(ctx, ChangeField::kPreview, me);
+}
+
+// StRS
+static void ParseStreamStatus(Context &ctx, AtemCommand &command) {
+  uint16_t state;
+  if (command.GetLength() != 12) return;
+  if (!layout::StreamStatus::Decode(command, state)) return;
+
+  ctx.event |= 1 << ATEM_EVENT_STREAM;
+  if (ctx.state.stream.Set(ctx.id, (StreamState)state))
+    Changed(ctx, ChangeField::kStream);
+}
+
+// TrPs
+static void ParseTransitionPosition(Context &ctx, AtemCommand &command) {
+  uint8_t me, flags;
+  TransitionPosition position;
+  if (!layout::TransitionPosition::Decode(command, me, flags,
+                                          position.position))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_TRANSITION_POSITION;
+
+  if (ctx.state.mix_effect.size() <= me) return;
+  position.in_transition = flags & 0x01;
+  if (ctx.state.mix_effect[me].transition.position.Set(ctx.id, position))
+    Changed(ctx, ChangeField::kTransitionPosition, me);
+}
+
+// TrSS
+static void ParseTransitionState(Context &ctx, AtemCommand &command) {
+  uint8_t me;
+  TransitionState state;
+  if (!layout::TransitionState::Decode(command, me, state.style, state.next))
+    return;
+  ctx.event |= 1 << ATEM_EVENT_TRANSITION_STATE;
+
+  if (ctx.state.mix_effect.size() <= me) return;
+  if (ctx.state.mix_effect[me].transition.state.Set(ctx.id, state))
+    Changed(ctx, ChangeField::kTransitionState, me);
+}
+
+// MARK: Lookup
+
+struct Entry {
+  uint32_t cmd;
+  Handler handler;
+};
+
+template <size_t N>
+static constexpr std::array<Entry, N> Sort(std::array<Entry, N> entries) {
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.cmd < b.cmd; });
+  return entries;
+}
+
+/**
+ * @brief All supported commands, sorted by cmd at compile time so the lookup
+ * can use a binary search.
+ */
+static constexpr auto kHandlers = Sort(std::to_array<Entry>({
+    {ATEM_CMD("_mpl"), ParseMediaPlayerConfig},
+    {ATEM_CMD("_MeC"), ParseMixEffectConfig},
+    {ATEM_CMD("_ver"), ParseProtocolVersion},
+    {ATEM_CMD("_pin"), ParseProductId},
+    {ATEM_CMD("_top"), ParseTopology},
+    {ATEM_CMD("AuxS"), ParseAuxSelect},
+    {ATEM_CMD("DskB"), ParseDskSource},
+    {ATEM_CMD("DskP"), ParseDskProperties},
+    {ATEM_CMD("DskS"), ParseDskState},
+    {ATEM_CMD("FtbS"), ParseFadeToBlackState},
+    {ATEM_CMD("InPr"), ParseInputProperty},
+    {ATEM_CMD("KeBP"), ParseUskProperties},
+    {ATEM_CMD("KeDV"), ParseUskDveProperties},
+    {ATEM_CMD("KeFS"), ParseUskFlyState},
+    {ATEM_CMD("KeOn"), ParseUskOnAir},
+    {ATEM_CMD("MPCE"), ParseMediaPlayerSource},
+    {ATEM_CMD("MPfe"), ParseMediaPoolFrame},
+    {ATEM_CMD("PrgI"), ParseProgramInput},
+    {ATEM_CMD("PrvI"), ParsePreviewInput},
+    {ATEM_CMD("StRS"), ParseStreamStatus},
+    {ATEM_CMD("TrPs"), ParseTransitionPosition},
+    {ATEM_CMD("TrSS"), ParseTransitionState},
+}));
+
+static_assert(std::adjacent_find(kHandlers.begin(), kHandlers.end(),
+                                 [](const Entry &a, const Entry &b) {
+                                   return a.cmd == b.cmd;
+                                 }) == kHandlers.end(),
+              "A command can only have a single handler");
+
+Handler FindHandler(uint32_t cmd) {
+  auto it = std::lower_bound(
+      kHandlers.begin(), kHandlers.end(), cmd,
+      [](const Entry &entry, uint32_t cmd) { return entry.cmd < cmd; });
+
+  if (it == kHandlers.end() || it->cmd != cmd) return nullptr;
+  return it->handler;
+}
+
+}  // namespace parser
+
+}  // namespace atem
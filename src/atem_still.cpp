@@ -0,0 +1,196 @@
+#include "atem_still.h"
+
+#include <esp_log.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace atem {
+
+static const char* TAG{"StillEncoder"};
+
+// MARK: Color conversion
+
+// BT.709 in 10 bits with studio range, in fixed point with 16 bits fraction
+static constexpr double kKr = 0.2126, kKb = 0.0722, kKg = 1 - kKr - kKb;
+static constexpr double kY = 876.0 / 255, kC = 896.0 / 255;
+
+static constexpr int32_t Fixed(double v) {
+  return (int32_t)(v * 65536 + (v < 0 ? -0.5 : 0.5));
+}
+
+static constexpr int32_t kYr = Fixed(kKr * kY), kYg = Fixed(kKg * kY),
+                         kYb = Fixed(kKb * kY);
+static constexpr int32_t kCbR = Fixed(-kKr / (2 * (1 - kKb)) * kC),
+                         kCbG = Fixed(-kKg / (2 * (1 - kKb)) * kC),
+                         kCbB = Fixed(0.5 * kC);
+static constexpr int32_t kCrR = Fixed(0.5 * kC),
+                         kCrG = Fixed(-kKg / (2 * (1 - kKr)) * kC),
+                         kCrB = Fixed(-kKb / (2 * (1 - kKr)) * kC);
+static constexpr int32_t kA = Fixed(kY);
+
+static inline void WriteWord(uint8_t* out, uint32_t a, uint32_t c,
+                             uint32_t y) {
+  const uint32_t word = a << 20 | c << 10 | y;
+  out[0] = word >> 24;
+  out[1] = word >> 16;
+  out[2] = word >> 8;
+  out[3] = word;
+}
+
+void StillEncoder::ConvertLine(const uint8_t* rgba, uint8_t* yuva,
+                               uint16_t width) {
+  for (uint16_t x = 0; x < width; x += 2, rgba += 8, yuva += 8) {
+    const int32_t r1 = rgba[0], g1 = rgba[1], b1 = rgba[2];
+    const int32_t r2 = rgba[4], g2 = rgba[5], b2 = rgba[6];
+
+    const uint32_t y1 = 64 + ((kYr * r1 + kYg * g1 + kYb * b1 + 32768) >> 16);
+    const uint32_t y2 = 64 + ((kYr * r2 + kYg * g2 + kYb * b2 + 32768) >> 16);
+
+    // Both pixels share the chroma, use the average
+    const int32_t r = r1 + r2, g = g1 + g2, b = b1 + b2;
+    const uint32_t cb = 512 + ((kCbR * r + kCbG * g + kCbB * b + 65536) >> 17);
+    const uint32_t cr = 512 + ((kCrR * r + kCrG * g + kCrB * b + 65536) >> 17);
+
+    const uint32_t a1 = 64 + ((kA * rgba[3] + 32768) >> 16);
+    const uint32_t a2 = 64 + ((kA * rgba[7] + 32768) >> 16);
+
+    WriteWord(yuva, a1, cb, y1);
+    WriteWord(yuva + 4, a2, cr, y2);
+  }
+}
+
+// MARK: RLE
+
+StillEncoder::StillEncoder(uint16_t width, uint16_t height, Format format,
+                           LineReader reader, void* arg)
+    : width_(width),
+      height_(height),
+      format_(format),
+      reader_(reader),
+      arg_(arg),
+      line_((uint8_t*)malloc(this->width_ * 4)),
+      out_((uint8_t*)malloc(this->GetMaxLineLength())) {
+  // Every 2 pixels share the chroma
+  if (this->width_ % 2 != 0) {
+    ESP_LOGE(TAG, "The width of a still must be even (%u)", this->width_);
+  } else if (this->line_ == nullptr || this->out_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate the buffers of a line");
+  }
+}
+
+StillEncoder::~StillEncoder() {
+  free(this->line_);
+  free(this->out_);
+}
+
+static inline void WriteBigEndian(uint8_t* out, uint64_t value) {
+  for (int i = 7; i >= 0; i--, value >>= 8) out[i] = value;
+}
+
+size_t StillEncoder::WriteRun_(uint8_t* out) {
+  if (this->run_length_ == 0) return 0;
+
+  // Short runs are smaller without the header
+  if (this->run_length_ <= 2) {
+    for (uint64_t i = 0; i < this->run_length_; i++) {
+      memcpy(out + i * 8, &this->run_value_, 8);
+    }
+    return this->run_length_ * 8;
+  }
+
+  WriteBigEndian(out, kRleHeader);
+  WriteBigEndian(out + 8, this->run_length_);
+  memcpy(out + 16, &this->run_value_, 8);
+  return 24;
+}
+
+size_t StillEncoder::CompressLine(const uint8_t* yuva, uint8_t* out) {
+  const size_t count = this->width_ / 2;
+  uint8_t* start = out;
+
+  // Compare 2 pixels (8 bytes) at once
+  uint64_t words[2];
+  for (size_t i = 0; i < count;) {
+    memcpy(&words[0], yuva + i * 8, 8);
+
+    // Find the end of the run
+    size_t end = i + 1;
+    while (end < count) {
+      memcpy(&words[1], yuva + end * 8, 8);
+      if (words[1] != words[0]) break;
+      end++;
+    }
+
+    if (this->run_length_ != 0 && words[0] == this->run_value_) {
+      this->run_length_ += end - i;  // Continues the run of the last line
+    } else {
+      out += this->WriteRun_(out);
+      this->run_value_ = words[0];
+      this->run_length_ = end - i;
+    }
+    i = end;
+  }
+
+  // Keep the last run open, it may continue on the next line
+  return out - start;
+}
+
+size_t StillEncoder::Flush(uint8_t* out) {
+  const size_t length = this->WriteRun_(out);
+  this->run_length_ = 0;
+  return length;
+}
+
+bool StillEncoder::EncodeNextLine_() {
+  if (this->done_ || !this->IsValid()) return false;
+
+  this->out_pos_ = 0;
+  this->out_length_ = 0;
+
+  if (this->y_ < this->height_ &&
+      this->reader_(this->line_, this->y_, this->arg_)) {
+    // Convert the line in place
+    if (this->format_ == Format::kRGBA) {
+      ConvertLine(this->line_, this->line_, this->width_);
+    }
+
+    this->out_length_ = this->CompressLine(this->line_, this->out_);
+    this->y_++;
+  } else {
+    this->out_length_ = this->Flush(this->out_);
+    this->done_ = true;
+  }
+
+  return true;
+}
+
+void StillEncoder::Rewind() {
+  this->out_length_ = 0;
+  this->out_pos_ = 0;
+  this->y_ = 0;
+  this->done_ = false;
+  this->encoded_ = 0;
+  this->run_length_ = 0;
+}
+
+size_t StillEncoder::Read(void* buffer, size_t length) {
+  uint8_t* out = (uint8_t*)buffer;
+  size_t read = 0;
+
+  while (read < length) {
+    if (this->out_pos_ == this->out_length_ && !this->EncodeNextLine_()) break;
+
+    const size_t n =
+        std::min(length - read, this->out_length_ - this->out_pos_);
+    memcpy(out + read, this->out_ + this->out_pos_, n);
+    this->out_pos_ += n;
+    read += n;
+  }
+
+  this->encoded_ += read;
+  return read;
+}
+
+}  // namespace atem
@@ -0,0 +1,278 @@
+#include "atem_upload.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace atem {
+
+#if CONFIG_ATEM_STORE_SEND
+static const char *TAG{"AtemUpload"};
+
+// The commands the ATEM sends during a transfer
+static const char *const kHookCommands[] = {"LKOB", "FTCD", "FTDC", "FTDE"};
+
+MediaUpload::MediaUpload(Atem *atem)
+    : atem_(atem),
+      events_(xQueueCreate(8, sizeof(Event))),
+      window_(xSemaphoreCreateCounting(CONFIG_ATEM_UPLOAD_WINDOW,
+                                       CONFIG_ATEM_UPLOAD_WINDOW)) {}
+
+MediaUpload::~MediaUpload() {
+  vQueueDelete(this->events_);
+  vSemaphoreDelete(this->window_);
+}
+
+esp_err_t MediaUpload::UploadStill(uint16_t index, size_t size,
+                                   const char *name, Reader reader,
+                                   Rewind rewind, void *arg,
+                                   const char *description) {
+  if (size == 0 || name == nullptr || reader == nullptr || rewind == nullptr)
+    return ESP_ERR_INVALID_ARG;
+
+  // The hash is send before the data
+  uint8_t hash[16];
+  size_t remaining;
+  esp_err_t ret = this->Hash_(reader, rewind, arg, hash, remaining);
+  if (ret != ESP_OK) return ret;
+
+  // Start a new transfer
+  this->transfer_id_++;
+  this->chunk_result_ = ESP_OK;
+  this->stats_ = {0, 0, 0, 0};
+  xQueueReset(this->events_);
+
+  size_t hooks = 0;
+  for (; hooks < std::size(kHookCommands) && ret == ESP_OK; hooks++) {
+    ret = this->atem_->RegisterCommandHook(kHookCommands[hooks],
+                                           CommandHook_, this);
+  }
+
+  const int64_t start = esp_timer_get_time();
+
+  // Lock the store
+  Event event;
+  if (ret == ESP_OK) {
+    ret = this->atem_->SendCommands(cmd::LockState(kStillStore, true));
+  }
+  if (ret == ESP_OK) ret = this->WaitForEvent_(event);
+  if (ret == ESP_OK && event.type != EventType::kLockObtained) ret = ESP_FAIL;
+  const bool locked = ret == ESP_OK;
+
+  // Start the transfer
+  if (ret == ESP_OK) {
+    ret = this->atem_->SendCommands(
+        cmd::TransferUpload(this->transfer_id_, kStillStore, index, size, 1));
+  }
+
+  bool described = false;
+  while (ret == ESP_OK) {
+    ret = this->WaitForEvent_(event);
+    if (ret != ESP_OK) break;
+
+    if (event.type == EventType::kError) {
+      ESP_LOGE(TAG, "The ATEM rejected the transfer of still %u", index);
+      ret = ESP_FAIL;
+      break;
+    }
+    if (event.type == EventType::kComplete) break;
+    if (event.type != EventType::kContinue) continue;
+
+    // Describe the file before the first chunk
+    if (!described) {
+      ret = this->atem_->SendCommands(cmd::TransferDescription(
+          this->transfer_id_, name, description, hash));
+      described = true;
+    }
+
+    // The ATEM asks for the next chunks
+    if (ret == ESP_OK && remaining != 0) {
+      ret = this->SendChunks_(event, reader, arg, remaining);
+    }
+  }
+
+  // Wait until the callback of every packet with chunks has been called, so
+  // none uses this object after it's destroyed. Atem calls the callback of
+  // every queued packet, at the latest ATEM_ACK_TIMEOUT ms after sending it or
+  // when the connection is reset.
+  for (int i = 0; i < CONFIG_ATEM_UPLOAD_WINDOW; i++) {
+    while (!xSemaphoreTake(this->window_, kTimeout)) {
+      ESP_LOGW(TAG, "Waiting for %d packets with chunks",
+               CONFIG_ATEM_UPLOAD_WINDOW - i);
+    }
+  }
+  for (int i = 0; i < CONFIG_ATEM_UPLOAD_WINDOW; i++) {
+    xSemaphoreGive(this->window_);
+  }
+
+  // Release the store, only when the ATEM gave us the lock
+  if (locked) this->atem_->SendCommands(cmd::LockState(kStillStore, false));
+  for (size_t i = 0; i < hooks; i++) {
+    this->atem_->UnregisterCommandHook(kHookCommands[i], CommandHook_, this);
+  }
+
+  const int64_t duration = esp_timer_get_time() - start;
+  this->stats_.duration = duration;
+  if (duration > 0) {
+    this->stats_.throughput = this->stats_.bytes * 1000000LL / duration;
+  }
+
+  if (ret == ESP_OK) {
+    ESP_LOGI(TAG, "Uploaded still %u (%zu bytes) in %lu ms, %lu kB/s", index,
+             this->stats_.bytes, (unsigned long)(duration / 1000),
+             (unsigned long)(this->stats_.throughput / 1000));
+  }
+
+  return ret;
+}
+
+esp_err_t MediaUpload::Hash_(Reader reader, Rewind rewind, void *arg,
+                             uint8_t *hash, size_t &length) {
+  uint8_t buffer[256];
+  mbedtls_md5_context md5;
+  mbedtls_md5_init(&md5);
+  mbedtls_md5_starts(&md5);
+
+  length = 0;
+  for (;;) {
+    const size_t n =
+        std::min(reader(buffer, sizeof(buffer), arg), sizeof(buffer));
+    mbedtls_md5_update(&md5, buffer, n);
+    length += n;
+    if (n != sizeof(buffer)) break;
+  }
+
+  mbedtls_md5_finish(&md5, hash);
+  mbedtls_md5_free(&md5);
+
+  if (length == 0) {
+    ESP_LOGE(TAG, "There is no data to upload");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!rewind(arg)) {
+    ESP_LOGE(TAG, "Failed to rewind the data");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t MediaUpload::WaitForEvent_(Event &event) {
+  for (;;) {
+    if (!xQueueReceive(this->events_, &event, kTimeout)) {
+      ESP_LOGW(TAG, "The ATEM didn't respond");
+      return ESP_ERR_TIMEOUT;
+    }
+
+    // Ignore commands about other transfers
+    const uint16_t id = event.type == EventType::kLockObtained
+                            ? kStillStore
+                            : this->transfer_id_;
+    if (event.id == id) return ESP_OK;
+  }
+}
+
+esp_err_t MediaUpload::SendChunks_(const Event &event, Reader reader,
+                                   void *arg, size_t &remaining) {
+  // A single chunk must always fit in a packet that isn't fragmented
+  constexpr uint16_t kHeader = cmd::TransferData::kHeader;
+  const uint16_t chunk_size =
+      std::min<uint16_t>(event.chunk_size, Atem::kTxMtu - 12 - kHeader);
+  if (chunk_size == 0) return ESP_FAIL;
+  const uint16_t per_packet = (Atem::kTxMtu - 12) / (kHeader + chunk_size);
+
+  for (uint16_t sent = 0; sent < event.chunk_count && remaining != 0;) {
+    // Wait for room in the window before taking a buffer
+    if (!xSemaphoreTake(this->window_, kTimeout)) return ESP_ERR_TIMEOUT;
+    if (this->chunk_result_ != ESP_OK) {
+      xSemaphoreGive(this->window_);
+      return this->chunk_result_;
+    }
+
+    // Put as many chunks in a packet as possible, the reader writes directly
+    // into the packet
+    const uint16_t count = std::min<size_t>(
+        {(size_t)event.chunk_count - sent, per_packet,
+         (remaining + chunk_size - 1) / chunk_size});
+    const uint16_t data_length =
+        std::min<size_t>((size_t)count * chunk_size, remaining);
+    AtemPacket packet(0x1, 0, 12 + count * kHeader + data_length);
+    if (unlikely(packet.GetData() == nullptr)) {
+      xSemaphoreGive(this->window_);
+      return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *data = (uint8_t *)packet.GetData() + 12;
+    for (uint16_t i = 0; i < count; i++) {
+      const uint16_t length = std::min<size_t>(chunk_size, remaining);
+      const size_t n = reader(data + kHeader, length, arg);
+
+      // The data must be the same as when it was hashed
+      if (n != length) {
+        ESP_LOGE(TAG, "The data changed after rewinding");
+        xSemaphoreGive(this->window_);
+        return ESP_ERR_INVALID_SIZE;
+      }
+
+      cmd::TransferData::WriteHeader(data, this->transfer_id_, length);
+      data += kHeader + length;
+      remaining -= length;
+      this->stats_.bytes += length;
+      this->stats_.chunks++;
+    }
+    sent += count;
+
+    const esp_err_t ret =
+        this->atem_->SendPacket(std::move(packet), ChunkAcked_, this);
+    if (ret != ESP_OK) {
+      xSemaphoreGive(this->window_);
+      return ret;
+    }
+  }
+
+  return ESP_OK;
+}
+
+void MediaUpload::CommandHook_(AtemCommand &command, void *arg) {
+  MediaUpload *upload = (MediaUpload *)arg;
+  Event event = {EventType::kError, 0, 0, 0};
+  bool valid = false;
+
+  switch (ATEM_CMD(((const char *)command.GetCmd()))) {
+    case ATEM_CMD("LKOB"):
+      event.type = EventType::kLockObtained;
+      valid = layout::LockObtained::Decode(command, event.id);
+      break;
+    case ATEM_CMD("FTCD"):
+      event.type = EventType::kContinue;
+      valid = layout::TransferContinue::Decode(
+          command, event.id, event.chunk_size, event.chunk_count);
+      break;
+    case ATEM_CMD("FTDC"):
+      event.type = EventType::kComplete;
+      valid = layout::TransferComplete::Decode(command, event.id);
+      break;
+    case ATEM_CMD("FTDE"): {
+      uint8_t code;
+      valid = layout::TransferError::Decode(command, event.id, code);
+      if (valid) ESP_LOGW(TAG, "Transfer %u failed (%u)", event.id, code);
+      break;
+    }
+  }
+
+  if (valid && !xQueueSend(upload->events_, &event, 0)) {
+    ESP_LOGW(TAG, "Missed a command of the ATEM");
+  }
+}
+
+void MediaUpload::ChunkAcked_(esp_err_t result, uint32_t latency, void *arg) {
+  MediaUpload *upload = (MediaUpload *)arg;
+  if (result != ESP_OK) upload->chunk_result_ = result;
+  xSemaphoreGive(upload->window_);
+}
+#endif
+
+}  // namespace atem
@@ -0,0 +1,124 @@
+#include "string_arena.h"
+
+#include <esp_log.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace atem {
+
+static const char *TAG{"StringArena"};
+
+// The offsets are stored in 16 bits
+static constexpr size_t kMaxSize = UINT16_MAX;
+
+StringArena::~StringArena() { free(this->slots_); }
+
+StringArena::StringArena(StringArena &&other) noexcept {
+  *this = std::move(other);
+}
+
+StringArena &StringArena::operator=(StringArena &&other) noexcept {
+  std::swap(this->slots_, other.slots_);
+  std::swap(this->data_, other.data_);
+  std::swap(this->count_, other.count_);
+  std::swap(this->size_, other.size_);
+  std::swap(this->used_, other.used_);
+  return *this;
+}
+
+void StringArena::Reserve(uint16_t count) {
+  if (count <= this->count_) return;
+  this->Rebuild_(count, std::max(this->size_,
+                                 std::min(count * kAverageLength, kMaxSize)));
+}
+
+bool StringArena::Set(uint16_t index, int16_t id, const char *value,
+                      uint8_t length) {
+  // Grow when the index wasn't reserved
+  if (index >= this->count_) {
+    if (index == UINT16_MAX) return false;
+    const uint16_t count = std::max<uint32_t>(
+        index + 1, std::min<uint32_t>(this->count_ * 2, UINT16_MAX));
+    const size_t size =
+        std::max(this->size_, std::min(count * kAverageLength, kMaxSize));
+    if (!this->Rebuild_(count, size)) return false;
+  }
+
+  Slot *slot = &this->slots_[index];
+  if (id < slot->id) return false;  // The current data is newer
+
+  slot->id = id;
+  slot->used = false;
+  if (value == nullptr) return true;
+
+  // Append the string when it doesn't fit in the space of the previous one
+  if (slot->capacity < length + 1) {
+    if (this->used_ + length + 1 > this->size_) {
+      // Compact the strings, and grow when that isn't enough
+      size_t used = length + 1;
+      for (uint16_t i = 0; i < this->count_; i++) {
+        if (this->slots_[i].used) used += this->slots_[i].length + 1;
+      }
+
+      const size_t size =
+          used <= this->size_
+              ? this->size_
+              : std::min(std::max(this->size_ * 2, used), kMaxSize);
+      if (used > size || !this->Rebuild_(this->count_, size)) {
+        ESP_LOGW(TAG, "No room for a string of %u bytes", length);
+        return false;
+      }
+      slot = &this->slots_[index];
+    }
+
+    slot->offset = this->used_;
+    slot->capacity = length + 1;
+    this->used_ += length + 1;
+  }
+
+  memcpy(this->data_ + slot->offset, value, length);
+  this->data_[slot->offset + length] = '\0';
+  slot->length = length;
+  slot->used = true;
+  return true;
+}
+
+bool StringArena::Rebuild_(uint16_t count, size_t size) {
+  Slot *slots = (Slot *)malloc(count * sizeof(Slot) + size);
+  if (slots == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate %u strings", count);
+    return false;
+  }
+  char *data = (char *)(slots + count);
+
+  // Copy the strings that are used behind each other
+  size_t used = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    if (i >= this->count_) {
+      slots[i] = {INT16_MIN, 0, 0, 0, false};
+      continue;
+    }
+
+    slots[i] = this->slots_[i];
+    slots[i].capacity = 0;
+    if (!slots[i].used) continue;
+
+    memcpy(data + used, this->data_ + slots[i].offset, slots[i].length + 1);
+    slots[i].offset = used;
+    slots[i].capacity = slots[i].length + 1;
+    used += slots[i].length + 1;
+  }
+
+  free(this->slots_);
+  this->slots_ = slots;
+  this->data_ = data;
+  this->count_ = count;
+  this->size_ = size;
+  this->used_ = used;
+  return true;
+}
+
+}  // namespace atem